@@ -0,0 +1,196 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BENCH_MAX_RESULTS   256
+#define BENCH_THRESHOLD     10.0    /* Percent slower that counts as a regression */
+
+struct bench_result {
+    char name[48];
+    char param[16];
+    double value;
+    char unit[8];
+};
+
+struct bench_suite {
+    const char *name;
+    void (*run)(void);
+};
+
+static const struct bench_suite m_suites[] = {
+    { "frame",  bench_frame },
+    { "queue",  bench_queue },
+    { "router", bench_router },
+    { "e2e",    bench_e2e },
+};
+
+static uint32_t m_seed = 0x12345678;
+
+static struct bench_result m_results[BENCH_MAX_RESULTS];
+static int m_no_results;
+static int m_csv;
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t bench_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint32_t bench_rand(void)
+{
+    /* xorshift32 */
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+}
+
+static void bench_record(const char *name, const char *param, double value, const char *unit)
+{
+    struct bench_result *r;
+
+    if(m_csv)
+        printf("%s,%s,%.2f,%s\n", name, param, value, unit);
+
+    if(m_no_results == BENCH_MAX_RESULTS)
+        return;
+
+    r = &m_results[m_no_results++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->param, sizeof(r->param), "%s", param);
+    snprintf(r->unit, sizeof(r->unit), "%s", unit);
+    r->value = value;
+}
+
+void bench_report(const char *name, const char *param, uint64_t ops, uint64_t ns)
+{
+    if(!m_csv)
+        printf("%-32s %-12s %10.2f ns/op %10.2f Mops/s\n",
+               name, param, (double)ns / ops, (ops * 1000.0) / ns);
+
+    bench_record(name, param, (double)ns / ops, "ns/op");
+}
+
+void bench_report_value(const char *name, const char *param, double value, const char *unit)
+{
+    if(!m_csv)
+        printf("%-32s %-12s %10.2f %s\n", name, param, value, unit);
+
+    bench_record(name, param, value, unit);
+}
+
+static struct bench_result* bench_find(const char *name, const char *param)
+{
+    for(int i = 0 ; i < m_no_results ; i++) {
+        if(strcmp(m_results[i].name, name) == 0 && strcmp(m_results[i].param, param) == 0)
+            return &m_results[i];
+    }
+
+    return NULL;
+}
+
+/* Compares the results with a baseline saved from an earlier run with -c.
+   Returns the number of results more than threshold percent worse. */
+static int bench_compare(const char *path, double threshold)
+{
+    struct bench_result *r;
+    char line[128], name[48], param[16], unit[8];
+    double base, delta;
+    int regressions = 0;
+    FILE *fp = fopen(path, "r");
+
+    if(!fp) {
+        perror("Failed to open baseline");
+        return -1;
+    }
+
+    fprintf(stderr, "\n%-32s %-12s %12s %12s %8s\n", "benchmark", "param", "baseline", "current", "change");
+
+    while(fgets(line, sizeof(line), fp)) {
+        if(sscanf(line, "%47[^,],%15[^,],%lf,%7s", name, param, &base, unit) != 4)
+            continue;
+
+        r = bench_find(name, param);
+        if(!r || base <= 0)
+            continue;
+
+        delta = 100.0 * (r->value - base) / base;
+        fprintf(stderr, "%-32s %-12s %12.2f %12.2f %+7.1f%%%s\n",
+                name, param, base, r->value, delta, (delta > threshold) ? "  REGRESSION" : "");
+
+        if(delta > threshold)
+            regressions++;
+    }
+
+    fclose(fp);
+    return regressions;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-c] [-b baseline.csv] [-t percent] [suite...]\n"
+            "  -c    print results as CSV (name,param,value,unit) to save as a baseline\n"
+            "  -b    compare with a baseline and exit with 1 on a regression\n"
+            "  -t    percent a result may be worse than its baseline, %.0f by default\n"
+            "Suites: frame queue router e2e, all by default\n",
+            prog, BENCH_THRESHOLD);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *baseline = NULL;
+    double threshold = BENCH_THRESHOLD;
+    int opt, regressions;
+    bool found;
+
+    while((opt = getopt(argc, argv, "cb:t:h")) != -1) {
+        switch(opt) {
+            case 'c': m_csv = 1; break;
+            case 'b': baseline = optarg; break;
+            case 't': threshold = atof(optarg); break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if(m_csv)
+        printf("name,param,value,unit\n");
+    else
+        printf("***** XCAN Benchmarks *****\n");
+
+    for(int i = 0 ; i < sizeof(m_suites) / sizeof(m_suites[0]) ; i++) {
+        found = (optind == argc);
+        for(int j = optind ; j < argc ; j++)
+            found |= (strcmp(argv[j], m_suites[i].name) == 0);
+
+        if(found)
+            m_suites[i].run();
+    }
+
+    if(!baseline)
+        return 0;
+
+    regressions = bench_compare(baseline, threshold);
+    if(regressions < 0)
+        return 2;
+
+    fprintf(stderr, "%d regression(s) over %.0f%%\n", regressions, threshold);
+    return (regressions > 0) ? 1 : 0;
+}
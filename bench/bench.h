@@ -0,0 +1,31 @@
+#ifndef XCAN_BENCH_H
+#define XCAN_BENCH_H
+
+#include <stdint.h>
+
+/* Monotonic time in nanoseconds */
+uint64_t bench_now_ns(void);
+
+/* CPU time used by the process in nanoseconds */
+uint64_t bench_cpu_ns(void);
+
+/* Small fast PRNG so runs are reproducible */
+uint32_t bench_rand(void);
+
+/* Report the result of ops operations that took ns nanoseconds */
+void bench_report(const char *name, const char *param, uint64_t ops, uint64_t ns);
+
+/* Report a measurement other than a rate, such as a latency. Like ns/op,
+   lower values are taken to be better when comparing with a baseline. */
+void bench_report_value(const char *name, const char *param, double value, const char *unit);
+
+/* Suites */
+void bench_frame(void);
+
+void bench_queue(void);
+
+void bench_router(void);
+
+void bench_e2e(void);
+
+#endif /* XCAN_BENCH_H */
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "xcan_stack.h"
+#include "xcan_latency.h"
+#include "xcan_rcu.h"
+#include "xcan_dev_loopback.h"
+
+#define E2E_MS          500         /* Length of each timed profile */
+#define E2E_IDS         16          /* IDs each device sends */
+#define E2E_SATURATE    1000000     /* Frames per device in the saturation profile */
+#define E2E_DRAIN       10000       /* Ticks allowed to empty the queues afterwards */
+
+/* Frames per second on a 1 Mbit/s classic CAN bus fully loaded with 8 byte
+   standard frames */
+#define E2E_BUS_RATE    (1000000 / (XCAN_SCHED_SFF_BITS + 64))
+
+/* Every device sends its own IDs, routed to the next device along */
+struct e2e_profile {
+    const char *name;
+    int devices;
+    uint32_t rate;          /* Frames per second per device, 0 for no limit */
+    uint32_t count;         /* Frames per device, 0 to run for E2E_MS */
+    uint32_t burst;         /* Frames per burst, 0 for steady traffic */
+    uint32_t burst_ms;      /* Time between bursts */
+};
+
+static const struct e2e_profile m_profiles[] = {
+    { "cyclic",   4, 2000,         0,            0,  0 },
+    { "bursty",   4, 0,            0,            64, 10 },
+    { "busload",  8, E2E_BUS_RATE, 0,            0,  0 },
+    { "saturate", 2, 0,            E2E_SATURATE, 0,  0 },
+};
+
+static struct xcan_device *m_devs[XCAN_MAX_DEVICES];
+static struct xcan_loopback_frame m_frames[XCAN_MAX_DEVICES][E2E_IDS];
+static struct xcan_routing_entry m_entries[XCAN_MAX_DEVICES];
+static uint8_t m_next[XCAN_MAX_DEVICES];
+
+static int e2e_setup(int n)
+{
+    struct xcan_routing_table tbl = { m_entries, n };
+    char name[XCAN_MAX_DEVICE_NAME];
+
+    for(int i = 0 ; i < n ; i++) {
+        m_next[i] = (i + 1) % n;
+        m_entries[i] = (struct xcan_routing_entry) {
+            .can_id = i * 0x80,
+            .can_id_last = i * 0x80 + 0x7F,
+            .interface_id = &m_next[i],
+            .no_interfaces = 1,
+        };
+
+        for(int j = 0 ; j < E2E_IDS ; j++)
+            m_frames[i][j] = (struct xcan_loopback_frame) { .id = i * 0x80 + j * 7, .len = 8 };
+    }
+
+    if(xcan_stack_init(&tbl) != 0)
+        return -1;
+
+    for(int i = 0 ; i < n ; i++) {
+        snprintf(name, sizeof(name), "lb%d", i);
+        m_devs[i] = xcan_loopback_create(i, name);
+        if(!m_devs[i])
+            return -1;
+    }
+
+    xcan_latency_reset();
+    return 0;
+}
+
+static void e2e_teardown(int n)
+{
+    for(int i = 0 ; i < n ; i++) {
+        if(m_devs[i])
+            xcan_device_destroy(m_devs[i]);
+        m_devs[i] = NULL;
+    }
+
+    xcan_rcu_quiescent();
+    xcan_rcu_reclaim();
+}
+
+static bool e2e_busy(int n)
+{
+    for(int i = 0 ; i < n ; i++) {
+        if(xcan_loopback_busy(m_devs[i]) || xcan_queue_len(m_devs[i]->q_in) ||
+           xcan_queue_len(m_devs[i]->q_out) || xcan_device_parked(m_devs[i]))
+            return true;
+    }
+
+    return false;
+}
+
+static void e2e_report(const struct e2e_profile *p, uint64_t ns)
+{
+    static struct xcan_hist total, h;
+    struct xcan_loopback_stats s;
+    uint64_t injected = 0, sent = 0;
+    char name[48], param[16];
+
+    memset(&total, 0, sizeof(total));
+
+    for(int i = 0 ; i < p->devices ; i++) {
+        xcan_loopback_stats(m_devs[i], &s);
+        injected += s.injected + s.dropped;
+        sent += s.sent;
+
+        if(xcan_latency_device(i, XCAN_LATENCY_TOTAL, &h) != 0)
+            continue;
+
+        total.count += h.count;
+        total.sum += h.sum;
+        if(h.max > total.max)
+            total.max = h.max;
+        for(int b = 0 ; b < XCAN_HIST_BUCKETS ; b++)
+            total.bucket[b] += h.bucket[b];
+    }
+
+    if(!sent)
+        return;
+
+    snprintf(param, sizeof(param), "%ddev", p->devices);
+
+    /* Saturation is about throughput, the rest about the cost per frame */
+    snprintf(name, sizeof(name), "e2e_%s%s", p->name, p->count ? "" : "_cpu");
+    bench_report(name, param, sent, ns);
+
+    snprintf(name, sizeof(name), "e2e_%s_p50", p->name);
+    bench_report_value(name, param, xcan_hist_percentile(&total, 50), "ns");
+    snprintf(name, sizeof(name), "e2e_%s_p99", p->name);
+    bench_report_value(name, param, xcan_hist_percentile(&total, 99), "ns");
+    snprintf(name, sizeof(name), "e2e_%s_loss", p->name);
+    bench_report_value(name, param, 100.0 * (injected - sent) / injected, "%");
+}
+
+static void e2e_run(const struct e2e_profile *p)
+{
+    uint64_t start, now, end, next_burst, cpu;
+    int drain;
+
+    if(e2e_setup(p->devices) != 0) {
+        printf("e2e_%s: Failed to set up devices\n", p->name);
+        e2e_teardown(p->devices);
+        return;
+    }
+
+    start = now = bench_now_ns();
+    end = start + E2E_MS * 1000000ULL;
+    next_burst = start;
+    cpu = bench_cpu_ns();
+
+    if(!p->burst) {
+        for(int i = 0 ; i < p->devices ; i++)
+            xcan_loopback_inject(m_devs[i], m_frames[i], E2E_IDS, p->rate, p->count);
+    }
+
+    if(p->count) {
+        /* Flat out until every frame is through */
+        while(e2e_busy(p->devices))
+            xcan_stack_tick();
+    } else {
+        /* Sleep between frames as a gateway would */
+        while(now < end) {
+            if(p->burst && now >= next_burst) {
+                for(int i = 0 ; i < p->devices ; i++)
+                    xcan_loopback_inject(m_devs[i], m_frames[i], E2E_IDS, 0, p->burst);
+                next_burst += p->burst_ms * 1000000ULL;
+            }
+
+            xcan_stack_poll(1);
+            now = bench_now_ns();
+        }
+
+        for(int i = 0 ; i < p->devices ; i++)
+            xcan_loopback_stop(m_devs[i]);
+
+        for(drain = 0 ; drain < E2E_DRAIN && e2e_busy(p->devices) ; drain++)
+            xcan_stack_tick();
+    }
+
+    now = bench_now_ns();
+    cpu = bench_cpu_ns() - cpu;
+
+    e2e_report(p, p->count ? now - start : cpu);
+    e2e_teardown(p->devices);
+}
+
+void bench_e2e(void)
+{
+    for(int i = 0 ; i < sizeof(m_profiles) / sizeof(m_profiles[0]) ; i++)
+        e2e_run(&m_profiles[i]);
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "xcan_frame.h"
+
+#define FRAME_OPS   5000000
+
+static void bench_alloc(uint32_t size)
+{
+    struct xcan_frame *f;
+    uint64_t start, end;
+    char param[16];
+
+    start = bench_now_ns();
+    for(int i = 0 ; i < FRAME_OPS ; i++) {
+        f = xcan_frame_alloc(size);
+        xcan_frame_discard(f);
+    }
+    end = bench_now_ns();
+
+    snprintf(param, sizeof(param), "%u", size);
+    bench_report("frame_alloc_discard", param, FRAME_OPS, end - start);
+}
+
+/* Takes a burst out of the pool before giving it back, as a device does */
+static void bench_alloc_burst(uint32_t size)
+{
+    struct xcan_frame *f[XCAN_BURST];
+    uint64_t start, end;
+    char param[16];
+
+    start = bench_now_ns();
+    for(int i = 0 ; i < FRAME_OPS / XCAN_BURST ; i++) {
+        for(int j = 0 ; j < XCAN_BURST ; j++)
+            f[j] = xcan_frame_alloc(size);
+        for(int j = 0 ; j < XCAN_BURST ; j++)
+            xcan_frame_discard(f[j]);
+    }
+    end = bench_now_ns();
+
+    snprintf(param, sizeof(param), "%u", size);
+    bench_report("frame_alloc_discard_burst", param, (FRAME_OPS / XCAN_BURST) * XCAN_BURST, end - start);
+}
+
+/* Copies of a frame, as the router makes them for every destination */
+static void bench_copy(void)
+{
+    struct xcan_frame *owner = xcan_frame_alloc(XCAN_PAYLOAD_CAN), *f;
+    uint64_t start, end;
+
+    start = bench_now_ns();
+    for(int i = 0 ; i < FRAME_OPS ; i++) {
+        f = xcan_frame_copy(owner);
+        xcan_frame_discard(f);
+    }
+    end = bench_now_ns();
+
+    xcan_frame_discard(owner);
+    bench_report("frame_copy_discard", "8", FRAME_OPS, end - start);
+}
+
+void bench_frame(void)
+{
+    bench_alloc(XCAN_PAYLOAD_CAN);
+    bench_alloc(XCAN_PAYLOAD_CANFD);
+    bench_alloc_burst(XCAN_PAYLOAD_CAN);
+    bench_copy();
+}
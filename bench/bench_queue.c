@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "xcan_queue.h"
+
+#define QUEUE_OPS       5000000
+#define QUEUE_FRAMES    256
+
+static const struct {
+    enum xcan_queue_type type;
+    const char *name;
+} m_types[] = {
+    { XCAN_QUEUE_LIST, "list" },
+    { XCAN_QUEUE_RING, "ring" },
+    { XCAN_QUEUE_PRIO, "prio" },
+};
+
+static struct xcan_frame *m_frames[QUEUE_FRAMES];
+
+/* Fills the queue with depth frames and then passes the rest through it one
+   at a time, so every operation works on a queue of that depth */
+static void bench_single(struct xcan_queue *q, const char *name, uint32_t depth)
+{
+    struct xcan_frame *f;
+    uint64_t start, end;
+    char param[16];
+
+    for(uint32_t i = 0 ; i < depth ; i++)
+        xcan_enqueue(q, m_frames[i]);
+
+    start = bench_now_ns();
+    for(int i = 0 ; i < QUEUE_OPS ; i++) {
+        f = xcan_dequeue(q);
+        xcan_enqueue(q, f);
+    }
+    end = bench_now_ns();
+
+    while(xcan_dequeue(q))
+        ;
+
+    snprintf(param, sizeof(param), "%s/%u", name, depth);
+    bench_report("queue_dequeue_enqueue", param, QUEUE_OPS, end - start);
+}
+
+static void bench_bulk(struct xcan_queue *q, const char *name)
+{
+    struct xcan_frame *f[XCAN_BURST];
+    uint64_t start, end;
+    uint32_t n;
+
+    start = bench_now_ns();
+    for(int i = 0 ; i < QUEUE_OPS / XCAN_BURST ; i++) {
+        n = xcan_enqueue_bulk(q, &m_frames[(i * XCAN_BURST) % QUEUE_FRAMES], XCAN_BURST);
+        n = xcan_dequeue_bulk(q, f, n);
+    }
+    end = bench_now_ns();
+
+    bench_report("queue_enqueue_dequeue_bulk", name, (QUEUE_OPS / XCAN_BURST) * XCAN_BURST, end - start);
+}
+
+void bench_queue(void)
+{
+    struct xcan_queue q;
+
+    for(int i = 0 ; i < QUEUE_FRAMES ; i++) {
+        m_frames[i] = xcan_frame_alloc(XCAN_PAYLOAD_CAN);
+        /* Scattered but distinct, so coalescing never merges two */
+        m_frames[i]->id = (i * 997) & XCAN_SFF_MASK;
+    }
+
+    for(int i = 0 ; i < sizeof(m_types) / sizeof(m_types[0]) ; i++) {
+        if(xcan_queue_init(&q, m_types[i].type, QUEUE_FRAMES) != 0)
+            continue;
+
+        bench_single(&q, m_types[i].name, 1);
+        bench_single(&q, m_types[i].name, QUEUE_FRAMES / 2);
+        bench_bulk(&q, m_types[i].name);
+
+        xcan_queue_destroy(&q);
+    }
+
+    /* Coalescing looks every frame up in the queue index */
+    if(xcan_queue_init(&q, XCAN_QUEUE_LIST, QUEUE_FRAMES) == 0 &&
+       xcan_queue_set_coalesce(&q, true) == 0) {
+        bench_single(&q, "coalesce", QUEUE_FRAMES / 2);
+        xcan_queue_destroy(&q);
+    }
+
+    for(int i = 0 ; i < QUEUE_FRAMES ; i++)
+        xcan_frame_discard(m_frames[i]);
+}
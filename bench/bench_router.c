@@ -0,0 +1,97 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "xcan_router.h"
+
+#define LOOKUPS 2000000
+
+static volatile xcan_devmask_t m_sink;
+
+/* The lookup the router used before compiling its table: scan every entry
+   and collect the destinations of those matching. */
+static xcan_devmask_t linear_lookup(struct xcan_routing_table *tbl, uint32_t can_id)
+{
+    struct xcan_routing_entry *e;
+    xcan_devmask_t devices = 0;
+
+    for(uint32_t i = 0 ; i < tbl->no_entries ; i++) {
+        e = &tbl->entry[i];
+        if(e->can_id != can_id)
+            continue;
+
+        for(int j = 0 ; j < e->no_interfaces ; j++)
+            devices |= (xcan_devmask_t)1 << e->interface_id[j];
+    }
+
+    return devices;
+}
+
+static void build_table(struct xcan_routing_table *tbl, uint32_t entries, uint32_t flag)
+{
+    static uint8_t interfaces[XCAN_MAX_DEVICES];
+
+    for(int i = 0 ; i < XCAN_MAX_DEVICES ; i++)
+        interfaces[i] = i;
+
+    tbl->entry = XCAN_ZALLOC(entries * sizeof(struct xcan_routing_entry));
+    tbl->no_entries = entries;
+
+    for(uint32_t i = 0 ; i < entries ; i++) {
+        tbl->entry[i].can_id = flag | (bench_rand() & (flag ? XCAN_EFF_MASK : XCAN_SFF_MASK));
+        tbl->entry[i].interface_id = &interfaces[bench_rand() % (XCAN_MAX_DEVICES - 1)];
+        tbl->entry[i].no_interfaces = 2;
+    }
+}
+
+static void bench_lookup(const char *format, uint32_t flag, uint32_t entries)
+{
+    struct xcan_routing_table tbl;
+    uint32_t *ids = XCAN_ZALLOC(LOOKUPS * sizeof(uint32_t));
+    uint32_t linear_lookups;
+    uint64_t start, end;
+    char name[48], param[16];
+
+    build_table(&tbl, entries, flag);
+    xcan_router_init(&tbl);
+
+    /* Look up IDs present in the table */
+    for(int i = 0 ; i < LOOKUPS ; i++)
+        ids[i] = tbl.entry[bench_rand() % entries].can_id;
+
+    snprintf(param, sizeof(param), "%u", entries);
+
+    start = bench_now_ns();
+    for(int i = 0 ; i < LOOKUPS ; i++)
+        m_sink = xcan_router_lookup(ids[i]);
+    end = bench_now_ns();
+
+    snprintf(name, sizeof(name), "router_lookup_%s", format);
+    bench_report(name, param, LOOKUPS, end - start);
+
+    /* Keep the scan to a similar amount of work at every size */
+    linear_lookups = LOOKUPS / entries;
+    if(linear_lookups < 1000)
+        linear_lookups = 1000;
+
+    start = bench_now_ns();
+    for(uint32_t i = 0 ; i < linear_lookups ; i++)
+        m_sink = linear_lookup(&tbl, ids[i]);
+    end = bench_now_ns();
+
+    snprintf(name, sizeof(name), "router_lookup_%s_linear", format);
+    bench_report(name, param, linear_lookups, end - start);
+
+    XCAN_FREE(tbl.entry);
+    XCAN_FREE(ids);
+}
+
+void bench_router(void)
+{
+    static const uint32_t sizes[] = { 10, 100, 1000, 10000 };
+
+    for(int i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++)
+        bench_lookup("eff", XCAN_EFF_FLAG, sizes[i]);
+
+    for(int i = 0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++)
+        bench_lookup("sff", 0, sizes[i]);
+}
@@ -1,7 +1,7 @@
 #include <stdio.h>
-#include <unistd.h>
 
 #include "xcan_stack.h"
+#include "xcan_stats.h"
 #include "xcan_dev_socketcan.h"
 
 extern struct xcan_routing_table routing_table;
@@ -22,6 +22,12 @@ int main(int argc, char *argv[])
      */
     xcan_stack_init(&routing_table);
 
+    /**
+     * Publish counters for xcan-stat.
+     */
+    if(xcan_stats_export(XCAN_STATS_SHM) != 0)
+        printf("Counters not exported\n");
+
     /**
      * Register CAN-bus interfaces.
      */
@@ -34,12 +40,12 @@ int main(int argc, char *argv[])
         return -1;
 
     /**
-     * Process CAN frames.
+     * Process CAN frames as they arrive.
      */
     while(1)
     {
-        xcan_stack_tick();
-        sleep(2);
+        if(xcan_stack_poll(-1) < 0)
+            return -1;
     }
 
     return 0;
@@ -1,7 +1,7 @@
 #include "xcan_router.h"
 
 struct xcan_routing_table routing_table = {
-    .no_entries = 3,
+    .no_entries = 4,
     .entry = (struct xcan_routing_entry[]) { 
         {
             .can_id = 0,
@@ -18,6 +18,13 @@ struct xcan_routing_table routing_table = {
             .can_id = 2,
             .no_interfaces = 2,
             .interface_id = (uint8_t[]) { 0, 2 }
+        },
+        {
+            /* J1939 PGN 0xFEF1 at any priority, from any source address */
+            .can_id = XCAN_EFF_FLAG | 0x00FEF100,
+            .can_mask = 0x03FFFF00,
+            .no_interfaces = 1,
+            .interface_id = (uint8_t[]) { 1 }
         }
     }
 };
\ No newline at end of file
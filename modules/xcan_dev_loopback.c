@@ -0,0 +1,418 @@
+#include "xcan_dev_loopback.h"
+#include "xcan_stack.h"
+#include "xcan_time.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <sys/timerfd.h>
+
+struct xcan_device_loopback {
+    struct xcan_device dev;
+    int fd;     /* timerfd, readable while traffic is due */
+
+    /* Traffic, used by the receiving side only */
+    struct xcan_loopback_frame frames[XCAN_LOOPBACK_MAX_FRAMES];
+    /* Frame gets through the filters. Rewritten by route updates on any
+       thread while the receiving side reads it. */
+    _Atomic bool pass[XCAN_LOOPBACK_MAX_FRAMES];
+    int no_frames;
+    int next;
+    uint32_t rate;          /* Frames per second, 0 for no limit */
+    uint64_t count;         /* Frames to generate, 0 for no end */
+    uint64_t generated;     /* Including those filtered out */
+    uint64_t start;
+    _Atomic bool active;
+
+    struct xcan_filter filter[XCAN_MAX_FILTERS];
+    int no_filters;         /* -1 to accept everything */
+
+    /* Recording, used by the sending side only */
+    struct xcan_loopback_frame *record;
+    uint32_t record_max;
+    _Atomic uint32_t recorded;
+
+    /* Counters, each with a single writer */
+    _Atomic uint64_t injected XCAN_CACHE_ALIGNED;
+    _Atomic uint64_t filtered;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t sent XCAN_CACHE_ALIGNED;
+    _Atomic uint64_t sent_bytes;
+};
+
+
+/* ================================================================= */
+/* =======================      PRIVATE      ======================= */
+/* ================================================================= */
+
+static inline void counter_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static void prv_timer_set(struct xcan_device_loopback *lb, uint64_t interval_ns)
+{
+    struct itimerspec its = { 0 };
+
+    /* Expires at once, then every interval */
+    if(interval_ns) {
+        its.it_value.tv_nsec = 1;
+        its.it_interval.tv_sec = interval_ns / 1000000000ULL;
+        its.it_interval.tv_nsec = interval_ns % 1000000000ULL;
+    }
+
+    timerfd_settime(lb->fd, 0, &its, NULL);
+}
+
+static void prv_timer_drain(struct xcan_device_loopback *lb)
+{
+    uint64_t expired;
+    ssize_t r;
+
+    r = read(lb->fd, &expired, sizeof(expired));
+    (void) r;
+}
+
+static bool prv_filter_pass(struct xcan_device_loopback *lb, uint32_t id)
+{
+    if(lb->no_filters < 0)
+        return true;
+
+    for(int i = 0 ; i < lb->no_filters ; i++) {
+        if((id & lb->filter[i].mask) == (lb->filter[i].id & lb->filter[i].mask))
+            return true;
+    }
+
+    return false;
+}
+
+static void prv_filter_apply(struct xcan_device_loopback *lb)
+{
+    for(int i = 0 ; i < lb->no_frames ; i++)
+        atomic_store_explicit(&lb->pass[i], prv_filter_pass(lb, lb->frames[i].id),
+                              memory_order_relaxed);
+}
+
+/* Frames that should have been generated by now and have not been */
+static uint64_t prv_due(struct xcan_device_loopback *lb, uint64_t now)
+{
+    uint64_t elapsed, total;
+
+    if(!lb->rate) {
+        total = UINT64_MAX;
+    } else {
+        /* Split to keep elapsed * rate from overflowing */
+        elapsed = now - lb->start;
+        total = (elapsed / 1000000000ULL) * lb->rate +
+                ((elapsed % 1000000000ULL) * lb->rate) / 1000000000ULL + 1;
+    }
+
+    if(lb->count && total > lb->count)
+        total = lb->count;
+
+    return (total > lb->generated) ? total - lb->generated : 0;
+}
+
+static int prv_link_state(struct xcan_device *self)
+{
+    return 1;
+}
+
+static void prv_record(struct xcan_device_loopback *lb, uint32_t id, uint8_t flags,
+                       const uint8_t *data, uint16_t len)
+{
+    uint32_t n = atomic_load_explicit(&lb->recorded, memory_order_relaxed);
+    struct xcan_loopback_frame *r;
+
+    if(n >= lb->record_max)
+        return;
+
+    r = &lb->record[n];
+    r->id = id;
+    r->flags = flags;
+    r->len = (len < XCAN_PAYLOAD_CANFD) ? len : XCAN_PAYLOAD_CANFD;
+    memcpy(r->data, data, r->len);
+
+    atomic_store_explicit(&lb->recorded, n + 1, memory_order_release);
+}
+
+static int prv_send(struct xcan_device *self, uint32_t id, uint8_t flags, uint8_t *data, uint8_t len)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) self;
+
+    if(lb->record_max)
+        prv_record(lb, id, flags, data, len);
+
+    counter_add(&lb->sent, 1);
+    counter_add(&lb->sent_bytes, len);
+    return 0;
+}
+
+/* Takes every frame, the bus never backs up */
+static int prv_send_bulk(struct xcan_device *self, struct xcan_frame **f, int n)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) self;
+    uint64_t bytes = 0;
+
+    for(int i = 0 ; i < n ; i++) {
+        if(lb->record_max)
+            prv_record(lb, f[i]->id, f[i]->flags, f[i]->data, f[i]->len);
+        bytes += f[i]->len;
+    }
+
+    counter_add(&lb->sent, n);
+    counter_add(&lb->sent_bytes, bytes);
+    return n;
+}
+
+/* Generates the frames due, up to the loop score, straight into the device
+   input queue */
+static int prv_poll(struct xcan_device *self, int loop_score)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) self;
+
+    struct xcan_frame *burst[XCAN_BURST];
+    struct xcan_loopback_frame *t;
+    uint64_t now, due;
+    int count, accepted, n;
+    uint64_t filtered = 0, dropped = 0, injected = 0;
+
+    if(!lb->active)
+        return loop_score;
+
+    now = xcan_time_ns();
+    due = prv_due(lb, now);
+
+    while(loop_score > 0 && due > 0)
+    {
+        count = (loop_score < XCAN_BURST) ? loop_score : XCAN_BURST;
+        if(due < (uint64_t)count)
+            count = due;
+
+        n = 0;
+        for(int i = 0 ; i < count ; i++) {
+            t = &lb->frames[lb->next];
+            lb->next = (lb->next + 1 < lb->no_frames) ? lb->next + 1 : 0;
+
+            if(!atomic_load_explicit(&lb->pass[t - lb->frames], memory_order_relaxed)) {
+                filtered++;
+                continue;
+            }
+
+            burst[n] = xcan_frame_alloc(t->len);
+            if(!burst[n]) {
+                dropped++;
+                continue;
+            }
+
+            burst[n]->id = t->id;
+            burst[n]->flags = t->flags;
+            memcpy(burst[n]->data, t->data, t->len);
+            n++;
+        }
+
+        accepted = (n > 0) ? xcan_stack_recv_bulk(self, burst, n) : 0;
+        injected += accepted;
+        dropped += n - accepted;
+
+        lb->generated += count;
+        loop_score -= count;
+        due -= count;
+    }
+
+    counter_add(&lb->injected, injected);
+    counter_add(&lb->filtered, filtered);
+    counter_add(&lb->dropped, dropped);
+
+    if(lb->count && lb->generated >= lb->count) {
+        /* Done */
+        lb->active = false;
+        prv_timer_set(lb, 0);
+        prv_timer_drain(lb);
+    } else if(lb->rate && due == 0) {
+        /* Caught up, readable again on the next tick */
+        prv_timer_drain(lb);
+    }
+
+    return loop_score;
+}
+
+static int prv_get_fd(struct xcan_device *self)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) self;
+
+    return lb->fd;
+}
+
+/* Filters the generated traffic as the kernel would for a socket */
+static int prv_set_filter(struct xcan_device *self, const struct xcan_filter *filter, int n)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) self;
+
+    if(!filter) {
+        lb->no_filters = -1;
+    } else {
+        if(n > XCAN_MAX_FILTERS)
+            return -1;
+
+        memcpy(lb->filter, filter, n * sizeof(struct xcan_filter));
+        lb->no_filters = n;
+    }
+
+    prv_filter_apply(lb);
+    return 0;
+}
+
+/* ================================================================= */
+/* =======================      PUBLIC      ======================== */
+/* ================================================================= */
+
+
+void xcan_loopback_destroy(struct xcan_device *dev)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+
+    if(lb->fd >= 0)
+        close(lb->fd);
+
+    dbg("Loopback (%s): Destroyed.\n", lb->dev.name);
+    XCAN_FREE(lb->record);
+    XCAN_FREE(lb);
+}
+
+
+int xcan_loopback_inject(struct xcan_device *dev,
+                         const struct xcan_loopback_frame *frames, int n,
+                         uint32_t rate, uint64_t count)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+    uint64_t interval;
+
+    if(!frames || n < 1 || n > XCAN_LOOPBACK_MAX_FRAMES)
+        return -1;
+
+    for(int i = 0 ; i < n ; i++) {
+        if(frames[i].len > XCAN_PAYLOAD_CANFD)
+            return -1;
+    }
+
+    memcpy(lb->frames, frames, n * sizeof(struct xcan_loopback_frame));
+    lb->no_frames = n;
+    lb->next = 0;
+    lb->rate = rate;
+    lb->count = count;
+    lb->generated = 0;
+    lb->start = xcan_time_ns();
+    prv_filter_apply(lb);
+
+    /* Unlimited traffic keeps the timer expired until it is done */
+    interval = 1000000000ULL / (rate ? rate : 1);
+    if(interval < XCAN_LOOPBACK_TICK_US * 1000ULL)
+        interval = XCAN_LOOPBACK_TICK_US * 1000ULL;
+
+    prv_timer_set(lb, rate ? interval : 1000000000ULL);
+    lb->active = true;
+    return 0;
+}
+
+void xcan_loopback_stop(struct xcan_device *dev)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+
+    lb->active = false;
+    prv_timer_set(lb, 0);
+    prv_timer_drain(lb);
+}
+
+bool xcan_loopback_busy(struct xcan_device *dev)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+
+    return lb->active;
+}
+
+int xcan_loopback_record(struct xcan_device *dev, uint32_t max)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+    struct xcan_loopback_frame *record = NULL;
+
+    if(max) {
+        record = XCAN_ZALLOC(max * sizeof(struct xcan_loopback_frame));
+        if(!record)
+            return -1;
+    }
+
+    XCAN_FREE(lb->record);
+    lb->record = record;
+    lb->record_max = max;
+    atomic_store(&lb->recorded, 0);
+    return 0;
+}
+
+uint32_t xcan_loopback_recorded(struct xcan_device *dev, const struct xcan_loopback_frame **frames)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+
+    *frames = lb->record;
+    return atomic_load_explicit(&lb->recorded, memory_order_acquire);
+}
+
+void xcan_loopback_stats(struct xcan_device *dev, struct xcan_loopback_stats *stats)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+
+    stats->injected = atomic_load_explicit(&lb->injected, memory_order_relaxed);
+    stats->filtered = atomic_load_explicit(&lb->filtered, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&lb->dropped, memory_order_relaxed);
+    stats->sent = atomic_load_explicit(&lb->sent, memory_order_relaxed);
+    stats->sent_bytes = atomic_load_explicit(&lb->sent_bytes, memory_order_relaxed);
+    stats->recorded = atomic_load_explicit(&lb->recorded, memory_order_relaxed);
+}
+
+void xcan_loopback_reset_stats(struct xcan_device *dev)
+{
+    struct xcan_device_loopback *lb = (struct xcan_device_loopback *) dev;
+
+    atomic_store(&lb->injected, 0);
+    atomic_store(&lb->filtered, 0);
+    atomic_store(&lb->dropped, 0);
+    atomic_store(&lb->sent, 0);
+    atomic_store(&lb->sent_bytes, 0);
+}
+
+
+struct xcan_device* xcan_loopback_create(uint8_t id, char *name)
+{
+    struct xcan_device_loopback *lb = XCAN_ZALLOC(sizeof(struct xcan_device_loopback));
+
+    if(!lb)
+        return NULL;
+
+    lb->no_filters = -1;
+    lb->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(lb->fd < 0) {
+        dbg("Loopback (%s): Failed to create timer\n", name);
+        XCAN_FREE(lb);
+        return NULL;
+    }
+
+    /* Fill in vtable */
+    lb->dev.link_state  = prv_link_state;
+    lb->dev.send        = prv_send;
+    lb->dev.send_bulk   = prv_send_bulk;
+    lb->dev.poll        = prv_poll;
+    lb->dev.get_fd      = prv_get_fd;
+    lb->dev.set_filter  = prv_set_filter;
+    lb->dev.destroy     = xcan_loopback_destroy;
+
+    /* Register loopback interface as XCAN device */
+    if( 0 != xcan_device_init((struct xcan_device *) lb, id, name)) {
+        dbg("Loopback (%s): Failed to init XCAN device\n", name);
+        xcan_loopback_destroy((struct xcan_device *) lb);
+        return NULL;
+    }
+    dbg("Loopback (%s): XCAN Device created\n", name);
+    return (struct xcan_device *) lb;
+}
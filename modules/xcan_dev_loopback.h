@@ -0,0 +1,70 @@
+#ifndef XCAN_DEV_LOOPBACK_H
+#define XCAN_DEV_LOOPBACK_H
+
+#include "xcan_device.h"
+#include "xcan_frame.h"
+
+/* In-memory device for tests and benchmarks. It needs no kernel support:
+   received traffic is generated from a set of frames at a set rate, and
+   sent frames are counted and optionally recorded. Its file descriptor is
+   a timerfd that is readable while traffic is due, so it also works with
+   xcan_stack_poll() and the threaded pipeline. */
+
+/* Frames the traffic pattern may cycle through */
+#ifndef XCAN_LOOPBACK_MAX_FRAMES
+#define XCAN_LOOPBACK_MAX_FRAMES    64
+#endif
+
+/* Shortest wait between rate limited deliveries; faster rates deliver
+   several frames at a time */
+#ifndef XCAN_LOOPBACK_TICK_US
+#define XCAN_LOOPBACK_TICK_US       100
+#endif
+
+struct xcan_loopback_frame {
+    uint32_t id;
+    uint8_t flags;
+    uint8_t len;
+    uint8_t data[XCAN_PAYLOAD_CANFD];
+};
+
+struct xcan_loopback_stats {
+    uint64_t injected;      /* Frames handed to the stack */
+    uint64_t filtered;      /* Frames held back by the device filters */
+    uint64_t dropped;       /* Frames lost to an empty pool or a full input queue */
+    uint64_t sent;
+    uint64_t sent_bytes;    /* Payload bytes sent */
+    uint64_t recorded;      /* Sent frames recorded */
+};
+
+void xcan_loopback_destroy(struct xcan_device *dev);
+
+struct xcan_device* xcan_loopback_create(uint8_t id, char *name);
+
+/* Receives count frames (0 for no end), cycling through the n frames given,
+   at rate frames per second (0 for as fast as the stack polls). Replaces
+   any traffic still going. Not to be called while another thread polls
+   the device. */
+int xcan_loopback_inject(struct xcan_device *dev,
+                         const struct xcan_loopback_frame *frames, int n,
+                         uint32_t rate, uint64_t count);
+
+/* Stops the traffic */
+void xcan_loopback_stop(struct xcan_device *dev);
+
+/* Whether traffic is still to be received */
+bool xcan_loopback_busy(struct xcan_device *dev);
+
+/* Keeps the first max frames sent from now on, 0 to stop recording. Not to
+   be called while another thread sends on the device. */
+int xcan_loopback_record(struct xcan_device *dev, uint32_t max);
+
+/* Frames recorded so far, oldest first; returns the number available */
+uint32_t xcan_loopback_recorded(struct xcan_device *dev, const struct xcan_loopback_frame **frames);
+
+/* May be read from any thread while frames are forwarded */
+void xcan_loopback_stats(struct xcan_device *dev, struct xcan_loopback_stats *stats);
+
+void xcan_loopback_reset_stats(struct xcan_device *dev);
+
+#endif /* XCAN_DEV_LOOPBACK_H */
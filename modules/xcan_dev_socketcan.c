@@ -1,9 +1,16 @@
+#define _GNU_SOURCE
+
 #include "xcan_dev_socketcan.h"
 #include "xcan_stack.h"
+#include "xcan_time.h"
+#include "xcan_trace.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include <net/if.h>
 #include <sys/types.h>
@@ -12,11 +19,27 @@
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 struct xcan_device_socketcan {	
     struct xcan_device dev;
     // Anything else specific to SocketCAN
     int fd;
+    int batch;  /* Frames per recvmmsg/sendmmsg call */
+
+    /* Message vectors, set up once */
+    struct canfd_frame rx_frame[XCAN_SOCKETCAN_MAX_BATCH];
+    struct iovec rx_iov[XCAN_SOCKETCAN_MAX_BATCH];
+    struct mmsghdr rx_msg[XCAN_SOCKETCAN_MAX_BATCH];
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    } rx_ctrl[XCAN_SOCKETCAN_MAX_BATCH];
+
+    struct canfd_frame tx_frame[XCAN_SOCKETCAN_MAX_BATCH];
+    struct iovec tx_iov[XCAN_SOCKETCAN_MAX_BATCH];
+    struct mmsghdr tx_msg[XCAN_SOCKETCAN_MAX_BATCH];
 };
 
 
@@ -32,6 +55,35 @@ int prv_link_state(struct xcan_device *dev)
     return 1;
 }
 
+/* Kernel receive time of a message converted to the monotonic clock, or 0
+   if the kernel did not timestamp it. Software timestamps are taken from
+   the realtime clock; offset is monotonic minus realtime. */
+static uint64_t prv_rx_time(struct msghdr *msg, int64_t offset)
+{
+    struct cmsghdr *cmsg;
+    struct scm_timestamping *tss;
+    uint64_t real;
+
+    for(cmsg = CMSG_FIRSTHDR(msg) ; cmsg ; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPING)
+            continue;
+
+        tss = (struct scm_timestamping *) CMSG_DATA(cmsg);
+        real = (uint64_t)tss->ts[0].tv_sec * 1000000000ULL + tss->ts[0].tv_nsec;
+        return real ? real + offset : 0;
+    }
+
+    return 0;
+}
+
+static int64_t prv_clock_offset(void)
+{
+    struct timespec real;
+
+    clock_gettime(CLOCK_REALTIME, &real);
+    return (int64_t)xcan_time_ns() - (int64_t)((uint64_t)real.tv_sec * 1000000000ULL + real.tv_nsec);
+}
+
 int prv_send(struct xcan_device *self, uint32_t id, uint8_t flags, uint8_t *data, uint8_t len)
 {
     struct xcan_device_socketcan *sc = (struct xcan_device_socketcan *) self;
@@ -52,28 +104,141 @@ int prv_send(struct xcan_device *self, uint32_t id, uint8_t flags, uint8_t *data
     }
 
     nbytes = write(sc->fd, &frame, frame_len);
-    dbg("SocketCAN (%s): Sent %d bytes\n", sc->dev.name, nbytes);
-    return nbytes;
+    xcan_trace(XCAN_TRACE_DEV_SEND, self->id, id, nbytes);
+    return (nbytes == frame_len) ? 0 : -1;
+}
+
+/* Sends frames in batches with sendmmsg, stopping at the first frame the
+   socket does not take */
+int prv_send_bulk(struct xcan_device *self, struct xcan_frame **f, int n)
+{
+    struct xcan_device_socketcan *sc = (struct xcan_device_socketcan *) self;
+
+    int sent = 0;
+    int count, r;
+
+    while(sent < n)
+    {
+        count = (n - sent < sc->batch) ? n - sent : sc->batch;
+
+        for(int i = 0 ; i < count ; i++) {
+            struct xcan_frame *src = f[sent + i];
+            struct canfd_frame *frame = &sc->tx_frame[i];
+
+            frame->can_id = src->id;
+            frame->len    = src->len;
+            frame->flags  = (src->len > 8) ? src->flags : 0;
+            memcpy(frame->data, src->data, src->len);
+
+            sc->tx_iov[i].iov_len = (src->len > 8) ? CANFD_MTU : CAN_MTU;
+        }
+
+        r = sendmmsg(sc->fd, sc->tx_msg, count, MSG_DONTWAIT);
+        if(r <= 0)
+            break;
+
+        sent += r;
+        if(r < count)
+            break;
+    }
+
+    xcan_trace(XCAN_TRACE_DEV_SEND_BULK, self->id, sent, n);
+    return sent;
 }
 
+/* Receives frames in batches with recvmmsg until the socket is drained or
+   the loop score is used up */
 int prv_poll(struct xcan_device *self, int loop_score)
 {
     struct xcan_device_socketcan *sc = (struct xcan_device_socketcan *) self;
 
-    struct canfd_frame f;
-    int nbytes;
+    struct xcan_frame *burst[XCAN_SOCKETCAN_MAX_BATCH];
+    struct canfd_frame *frame;
+    int count, r, n;
+    int64_t offset;
+
+    while(loop_score > 0)
+    {
+        count = (loop_score < sc->batch) ? loop_score : sc->batch;
+
+        /* The kernel shrinks the control length to what it filled in */
+        for(int i = 0 ; i < count ; i++)
+            sc->rx_msg[i].msg_hdr.msg_controllen = sizeof(sc->rx_ctrl[i]);
+
+        r = recvmmsg(sc->fd, sc->rx_msg, count, MSG_DONTWAIT, NULL);
+        if(r <= 0)
+            break;
+
+        xcan_trace(XCAN_TRACE_DEV_RECV, self->id, r, count);
+
+        offset = prv_clock_offset();
+
+        n = 0;
+        for(int i = 0 ; i < r ; i++) {
+            frame = &sc->rx_frame[i];
+
+            if(sc->rx_msg[i].msg_len != CAN_MTU && sc->rx_msg[i].msg_len != CANFD_MTU)
+                continue;
+
+            burst[n] = xcan_frame_alloc(frame->len);
+            if(!burst[n])
+                continue;
+
+            burst[n]->id = frame->can_id;
+            burst[n]->flags = frame->flags;
+            burst[n]->ts = prv_rx_time(&sc->rx_msg[i].msg_hdr, offset);
+            memcpy(burst[n]->data, frame->data, frame->len);
+            n++;
+        }
+
+        /* Straight into the device input queue */
+        if(n > 0)
+            xcan_stack_recv_bulk(self, burst, n);
+
+        loop_score -= r;
+
+        /* Drained */
+        if(r < count)
+            break;
+    }
 
-    nbytes = read(sc->fd, &f, sizeof(struct can_frame));
+    return loop_score;
+}
+
+int prv_get_fd(struct xcan_device *self)
+{
+    struct xcan_device_socketcan *sc = (struct xcan_device_socketcan *) self;
+
+    return sc->fd;
+}
 
-    if(nbytes == CAN_MTU) {
-        dbg("SocketCAN (%s): Received CAN frame\n", sc->dev.name);
-    } else if(nbytes == CANFD_MTU) {
-        dbg("SocketCAN (%s): Received CAN-FD frame\n", sc->dev.name);
+/* Installs the filters in the kernel so unwanted frames never reach us */
+int prv_set_filter(struct xcan_device *self, const struct xcan_filter *filter, int n)
+{
+    struct xcan_device_socketcan *sc = (struct xcan_device_socketcan *) self;
+
+    struct can_filter rfilter[XCAN_MAX_FILTERS];
+
+    if(!filter) {
+        /* Accept everything */
+        rfilter[0].can_id = 0;
+        rfilter[0].can_mask = 0;
+        n = 1;
     } else {
-        dbg("SocketCAN (%s): Received unknown frame\n", sc->dev.name);
+        if(n > XCAN_MAX_FILTERS)
+            return -1;
+
+        for(int i = 0 ; i < n ; i++) {
+            rfilter[i].can_id = filter[i].id;
+            rfilter[i].can_mask = filter[i].mask;
+        }
     }
 
-    xcan_stack_recv(self, f.can_id, f.flags, f.data, f.len);
+    if(setsockopt(sc->fd, SOL_CAN_RAW, CAN_RAW_FILTER,
+                  (n > 0) ? rfilter : NULL, n * sizeof(struct can_filter)) != 0) {
+        dbg("SocketCAN (%s): Failed to set filters\n", sc->dev.name);
+        return -1;
+    }
 
     return 0;
 }
@@ -91,8 +256,20 @@ void xcan_socketcan_destroy(struct xcan_device *dev)
         dbg("SocketCAN (%s): Failed to close socket\n", sc->dev.name);
     }
 
-    free(sc);
     dbg("SocketCAN (%s): Destroyed.\n", sc->dev.name);
+    free(sc);
+}
+
+
+int xcan_socketcan_set_batch(struct xcan_device *dev, int batch)
+{
+    struct xcan_device_socketcan *sc = (struct xcan_device_socketcan *) dev;
+
+    if(batch < 1 || batch > XCAN_SOCKETCAN_MAX_BATCH)
+        return -1;
+
+    sc->batch = batch;
+    return 0;
 }
 
 
@@ -102,16 +279,46 @@ struct xcan_device* xcan_socketcan_create(uint8_t id, char *name)
 
     struct sockaddr_can addr;
     struct ifreq ifr;
+    int enable = 1;
+    int tstamp = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
 
     if(!sc)
         return NULL;
 
     /* Initialise SocketCAN interface */
-    if((sc->fd = socket(PF_CAN, SOCK_RAW, CAN_RAW_FD_FRAMES)) < 0) {
+    if((sc->fd = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
         dbg("SocketCAN (%s): Failed to open socket", name);
+        free(sc);
         return NULL;
     }
+
+    if(setsockopt(sc->fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) != 0) {
+        dbg("SocketCAN (%s): CAN-FD frames not supported\n", name);
+    }
     
+    /* Stamp frames as they arrive in the kernel, so their latency includes
+       the wait in the socket. Without it the stack stamps them on poll. */
+    if(setsockopt(sc->fd, SOL_SOCKET, SO_TIMESTAMPING, &tstamp, sizeof(tstamp)) != 0) {
+        dbg("SocketCAN (%s): Receive timestamps not supported\n", name);
+    }
+
+    fcntl(sc->fd, F_SETFL, fcntl(sc->fd, F_GETFL) | O_NONBLOCK);
+
+    /* Point each message at its own frame buffer */
+    sc->batch = (XCAN_BURST < XCAN_SOCKETCAN_MAX_BATCH) ? XCAN_BURST : XCAN_SOCKETCAN_MAX_BATCH;
+    for(int i = 0 ; i < XCAN_SOCKETCAN_MAX_BATCH ; i++) {
+        sc->rx_iov[i].iov_base = &sc->rx_frame[i];
+        sc->rx_iov[i].iov_len = sizeof(struct canfd_frame);
+        sc->rx_msg[i].msg_hdr.msg_iov = &sc->rx_iov[i];
+        sc->rx_msg[i].msg_hdr.msg_iovlen = 1;
+        sc->rx_msg[i].msg_hdr.msg_control = &sc->rx_ctrl[i];
+        sc->rx_msg[i].msg_hdr.msg_controllen = sizeof(sc->rx_ctrl[i]);
+
+        sc->tx_iov[i].iov_base = &sc->tx_frame[i];
+        sc->tx_msg[i].msg_hdr.msg_iov = &sc->tx_iov[i];
+        sc->tx_msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
     /* Retrieve the correct interface name */
     strcpy(ifr.ifr_name, name);
     ioctl(sc->fd, SIOCGIFINDEX, &ifr);
@@ -121,21 +328,26 @@ struct xcan_device* xcan_socketcan_create(uint8_t id, char *name)
 	addr.can_ifindex = ifr.ifr_ifindex;
 	if(bind(sc->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
 		perror("SocketCAN: Failed to bind socket");
+		close(sc->fd);
+		free(sc);
 		return NULL;
 	}
 
+    /* Fill in vtable */
+    sc->dev.link_state  = prv_link_state;
+    sc->dev.send        = prv_send;
+    sc->dev.send_bulk   = prv_send_bulk;
+    sc->dev.poll        = prv_poll;
+    sc->dev.get_fd      = prv_get_fd;
+    sc->dev.set_filter  = prv_set_filter;
+    sc->dev.destroy     = xcan_socketcan_destroy;
+
     /* Register SocketCAN interface as XCAN device */
     if( 0 != xcan_device_init((struct xcan_device *) sc, id, name)) {
         dbg("SocketCAN (%s): Failed to init XCAN device\n", name);
         xcan_socketcan_destroy((struct xcan_device*) sc);
         return NULL;
     }
-
-    /* Fill in vtable */
-    sc->dev.link_state  = prv_link_state;
-    sc->dev.send        = prv_send;
-    sc->dev.poll        = prv_poll;
-    sc->dev.destroy     = xcan_socketcan_destroy;
     dbg("SocketCAN (%s): XCAN Device created\n", name);
     return (struct xcan_device *) sc;
 }
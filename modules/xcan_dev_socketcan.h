@@ -3,8 +3,16 @@
 
 #include "xcan_device.h"
 
+/* Upper bound for the number of frames moved per recvmmsg/sendmmsg call */
+#ifndef XCAN_SOCKETCAN_MAX_BATCH
+#define XCAN_SOCKETCAN_MAX_BATCH 64
+#endif
+
 void xcan_socketcan_destroy(struct xcan_device *dev);
 
 struct xcan_device* xcan_socketcan_create(uint8_t id, char *name);
 
+/* Number of frames moved per system call, XCAN_BURST by default */
+int xcan_socketcan_set_batch(struct xcan_device *dev, int batch);
+
 #endif /* XCAN_DEV_SOCKETXCAN_H */
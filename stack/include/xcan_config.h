@@ -7,18 +7,151 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #else
 #include <linux/types.h>
 #endif /* __KERNEL__ */
 
+/* Debug messages go to stderr, so they never mix with what a program
+   prints on stdout */
 #ifdef DEBUG
 #include <stdio.h>
-#define dbg printf
+#define dbg(...) fprintf(stderr, __VA_ARGS__)
 #else
-#define dbg 
+#define dbg(...) do { } while(0)
 #endif
 
-#define XCAN_ZALLOC(x) calloc(x, 0)
+#define XCAN_CACHE_LINE 64
+#define XCAN_CACHE_ALIGNED __attribute__((aligned(XCAN_CACHE_LINE)))
+
+#define XCAN_ZALLOC(x) calloc(1, x)
 #define XCAN_FREE(x) free(x)
 
+/* Maximum number of frames moved between queues, router and drivers in
+   one burst */
+#ifndef XCAN_BURST
+#define XCAN_BURST  32
+#endif
+
+/* Time xcan_stack_tick() may take, and frames it moves between looking at
+   the clock */
+#ifndef XCAN_TICK_BUDGET_US
+#define XCAN_TICK_BUDGET_US     1000
+#endif
+
+#ifndef XCAN_TICK_SLICE
+#define XCAN_TICK_SLICE         XCAN_BURST
+#endif
+
+/* Threads that may read routing data concurrently */
+#ifndef XCAN_RCU_MAX_READERS
+#define XCAN_RCU_MAX_READERS    32
+#endif
+
+/* Frames handled per ready device on each pass of the event loop */
+#ifndef XCAN_EVENT_BUDGET
+#define XCAN_EVENT_BUDGET   256
+#endif
+
+/* Queue backend and depth used for device queues (see enum xcan_queue_type).
+   A depth of 0 leaves list queues unbounded. */
+#ifndef XCAN_DEVICE_QUEUE
+#define XCAN_DEVICE_QUEUE           XCAN_QUEUE_LIST
+#endif
+
+#ifndef XCAN_DEVICE_QUEUE_FRAMES
+#define XCAN_DEVICE_QUEUE_FRAMES    256
+#endif
+
+/* Credit a device gets for each round of the device scheduler, unless set
+   with xcan_device_set_weight() */
+#ifndef XCAN_SCHED_QUANTUM
+#define XCAN_SCHED_QUANTUM  XCAN_BURST
+#endif
+
+/* Frames that failed to send are parked and retried with exponential
+   backoff while the rest of the output queue keeps draining. Up to
+   XCAN_RETRY_FRAMES are parked per device, each retried at most
+   XCAN_RETRY_LIMIT times, first after XCAN_RETRY_BACKOFF_US. */
+#ifndef XCAN_RETRY_FRAMES
+#define XCAN_RETRY_FRAMES       32
+#endif
+
+#ifndef XCAN_RETRY_LIMIT
+#define XCAN_RETRY_LIMIT        5
+#endif
+
+#ifndef XCAN_RETRY_BACKOFF_US
+#define XCAN_RETRY_BACKOFF_US   100
+#endif
+
+/* Frame pool sizing. Frames are served from preallocated pools so the
+   forwarding path never touches the heap; an empty pool fails the
+   allocation and is counted as exhausted, not as a queue drop.
+
+   A device holds at most XCAN_DEVICE_FRAMES frames at once: full receive
+   and send queues, the ring between router and send thread in the
+   threaded pipeline, parked frames and a burst staged by the router. Every
+   frame queued for sending is a descriptor sharing the payload of the
+   frame received, so the CAN and CAN FD pools cover XCAN_POOL_DEVICES
+   devices with every queue full and the descriptors cover all their send
+   side frames; xcan_frame.c refuses to build with smaller pools. Raise
+   XCAN_POOL_DEVICES with the devices in use, and the pools by hand for
+   queues made larger with xcan_device_set_queue() or xcan_thread_start().
+   CAN XL frames are too large to cover every queue and share a small
+   pool. */
+#ifndef XCAN_POOL_DEVICES
+#define XCAN_POOL_DEVICES       4
+#endif
+
+#define XCAN_DEVICE_FRAMES \
+    (3 * XCAN_DEVICE_QUEUE_FRAMES + XCAN_RETRY_FRAMES + XCAN_BURST)
+
+#define XCAN_DEVICE_COPIES \
+    (2 * XCAN_DEVICE_QUEUE_FRAMES + XCAN_RETRY_FRAMES + XCAN_BURST)
+
+#ifndef XCAN_POOL_DESCRIPTORS
+#define XCAN_POOL_DESCRIPTORS   (XCAN_POOL_DEVICES * XCAN_DEVICE_COPIES)    /* Copies sharing another frame's payload */
+#endif
+
+#ifndef XCAN_POOL_CAN_FRAMES
+#define XCAN_POOL_CAN_FRAMES    (XCAN_POOL_DEVICES * XCAN_DEVICE_FRAMES)    /* Payloads up to 8 bytes (classic CAN) */
+#endif
+
+#ifndef XCAN_POOL_CANFD_FRAMES
+#define XCAN_POOL_CANFD_FRAMES  (XCAN_POOL_DEVICES * XCAN_DEVICE_FRAMES)    /* Payloads up to 64 bytes (CAN FD) */
+#endif
+
+#ifndef XCAN_POOL_XL_FRAMES
+#define XCAN_POOL_XL_FRAMES     16      /* Payloads up to 2048 bytes (CAN XL) */
+#endif
+
+/* Longest a thread of the threaded pipeline (see xcan_thread.h) sleeps
+   before looking again at a device without a file descriptor to wait on */
+#ifndef XCAN_THREAD_IDLE_MS
+#define XCAN_THREAD_IDLE_MS     1
+#endif
+
+/* Latency histograms per device and per route (see xcan_latency.h). Frames
+   are timestamped either way. */
+#ifndef XCAN_LATENCY
+#define XCAN_LATENCY    1
+#endif
+
+/* Routing table entries, counted from the first, with latency histograms */
+#ifndef XCAN_LATENCY_ROUTES
+#define XCAN_LATENCY_ROUTES     64
+#endif
+
+/* Counters per device and per route (see xcan_stats.h), and per queue
+   (see xcan_queue_stats()) */
+#ifndef XCAN_STATS
+#define XCAN_STATS      1
+#endif
+
+/* Routing table entries, counted from the first, with counters */
+#ifndef XCAN_STATS_ROUTES
+#define XCAN_STATS_ROUTES       256
+#endif
+
 #endif /* XCAN_CONFIG_H */
\ No newline at end of file
@@ -7,27 +7,171 @@
 
 #define XCAN_MAX_DEVICE_NAME 16
 
-#define XCAN_MAX_DEVICES 4
+/* Device IDs run from 0 to XCAN_MAX_DEVICES - 1 */
+#ifndef XCAN_MAX_DEVICES
+#define XCAN_MAX_DEVICES 32
+#endif
+
+/* One bit per device ID */
+#if XCAN_MAX_DEVICES <= 32
+typedef uint32_t xcan_devmask_t;
+#elif XCAN_MAX_DEVICES <= 64
+typedef uint64_t xcan_devmask_t;
+#else
+#error "XCAN_MAX_DEVICES must not exceed 64"
+#endif
+
+/* Receive filter, accepting frames where (id & mask) == (filter.id & mask).
+   Both fields may include XCAN_EFF_FLAG, as with SocketCAN. */
+struct xcan_filter {
+    uint32_t id;
+    uint32_t mask;
+};
+
+#define XCAN_MAX_FILTERS    512
+
+#define XCAN_LOOP_DIR_IN    0
+#define XCAN_LOOP_DIR_OUT   1
+
+/* Units of device scheduler weights */
+enum xcan_sched_unit {
+    XCAN_SCHED_FRAMES,  /* Every frame costs 1 */
+    XCAN_SCHED_BITS,    /* Frames cost their nominal length on the bus */
+};
+
+/* Nominal bits of a frame besides its payload: SOF, arbitration, control,
+   CRC, delimiters, EOF and intermission. CAN FD frames add the longer CRC
+   and FD control bits. Stuff bits are not counted. */
+#define XCAN_SCHED_SFF_BITS     47
+#define XCAN_SCHED_EFF_BITS     67
+#define XCAN_SCHED_FD_BITS      18
+
+/* Nominal bits of f on the bus: overhead of the frame format plus the
+   payload, without stuff bits and as if CAN FD data were sent at
+   arbitration rate */
+static inline uint32_t xcan_frame_bits(const struct xcan_frame *f)
+{
+    return ((f->id & XCAN_EFF_FLAG) ? XCAN_SCHED_EFF_BITS : XCAN_SCHED_SFF_BITS) +
+           ((f->len > XCAN_PAYLOAD_CAN) ? XCAN_SCHED_FD_BITS : 0) + 8 * f->len;
+}
+
+/* Deficit round robin state, per loop direction */
+struct xcan_device_sched {
+    uint8_t unit[2];
+    uint32_t quantum[2];
+    int64_t deficit[2];
+};
+
+/* Frames taken off the output queue after the driver failed to send them.
+   Parked frames keep their order, and frames with the ID of a parked
+   frame are parked behind it, so frames of one ID never overtake each
+   other. Only whoever sends for the device touches them; the counts are
+   also read from other threads, so they are written with relaxed stores
+   by that single writer. */
+struct xcan_device_retry {
+    struct xcan_frame *frame[XCAN_RETRY_FRAMES];
+    uint64_t deadline[XCAN_RETRY_FRAMES];   /* Next attempt, xcan_time_ns() */
+    uint8_t failed[XCAN_RETRY_FRAMES];      /* Failed attempts so far */
+    _Atomic uint32_t count;
+    _Atomic uint64_t retries;
+    _Atomic uint64_t dropped;
+};
+
+struct xcan_retry_stats {
+    uint32_t parked;    /* Frames waiting to be retried */
+    uint64_t retries;   /* Attempts to send a frame again */
+    uint64_t dropped;   /* Frames dropped after XCAN_RETRY_LIMIT retries */
+};
 
 struct xcan_device {
     uint8_t id;
     char name[XCAN_MAX_DEVICE_NAME];
     struct xcan_queue *q_in;
     struct xcan_queue *q_out;
+    /* Queue the router delivers to: q_out, or in threaded mode a ring the
+       device's send thread empties into q_out */
+    struct xcan_queue *q_routed;
     int (*link_state)(struct xcan_device *self);
     int (*send)(struct xcan_device *self, uint32_t id, uint8_t flags, uint8_t *data, uint8_t len);
+    /* Optional. Sends frames in order until one fails and returns the
+       number sent. Frames remain owned by the stack. */
+    int (*send_bulk)(struct xcan_device *self, struct xcan_frame **f, int n);
     int (*poll)(struct xcan_device *self, int loop_score);
+    /* Optional. File descriptor that becomes readable when poll has work,
+       or -1. Lets the event loop sleep until the device is ready. */
+    int (*get_fd)(struct xcan_device *self);
+    /* Optional. Only receive frames matching one of n filters; no frames
+       if n is 0 and all frames if filter is NULL. */
+    int (*set_filter)(struct xcan_device *self, const struct xcan_filter *filter, int n);
     void (*destroy)(struct xcan_device *self);
+
+    uint32_t events;    /* Events the event loop watches for, 0 if none */
+
+    struct xcan_device_retry retry;
+    struct xcan_device_sched sched;
 };
 
+/* The vtable must be filled in before the device is initialised. Devices
+   may be added and destroyed while the stack is running; a destroyed
+   device is freed once the forwarding loop has passed a quiescent point
+   (see xcan_rcu.h). */
 int xcan_device_init(struct xcan_device *dev, uint8_t id, const char *name);
 
 void xcan_device_destroy(struct xcan_device *dev);
 
+/* Replaces a queue of dev, discarding the frames in it. An XCAN_QUEUE_PRIO
+   output queue sends the lowest CAN ID first, as arbitration on the bus
+   would, so high priority frames never wait behind queued low priority
+   ones. */
+int xcan_device_set_queue(struct xcan_device *dev, int direction,
+                          enum xcan_queue_type type, uint32_t max_frames);
+
+/* Turns last value queueing (see xcan_queue_set_coalesce()) on or off for
+   every frame passing through a queue of dev */
+int xcan_device_set_coalesce(struct xcan_device *dev, int direction, bool coalesce);
+
+/* Sets the share of the loop budget dev gets in one direction when the
+   stack serves several devices: each round it may move frames worth
+   quantum, in frames or in bits on the bus. A device busy receiving can
+   then not hold up the others. Defaults to XCAN_SCHED_QUANTUM frames. */
+int xcan_device_set_weight(struct xcan_device *dev, int direction,
+                           enum xcan_sched_unit unit, uint32_t quantum);
+
+/* Moves up to loop_score frames in one direction for the n devices in devs,
+   shared by deficit round robin according to their weights. Returns what
+   is left of loop_score. */
+int xcan_devices_serve(struct xcan_device *const *devs, uint32_t n, int loop_score, int direction);
+
+/* xcan_devices_serve() for all registered devices */
 int xcan_devices_loop(int loop_score, int direction);
 
+/* Serves a single device up to loop_score, ignoring its weight */
+int xcan_device_loop(struct xcan_device *dev, int loop_score, int direction);
+
 struct xcan_device* xcan_get_device(uint8_t id);
 
+/* Registered devices, stored in *n. Like xcan_get_device(), valid on the
+   forwarding path until the caller's next quiescent state. */
+struct xcan_device* const* xcan_device_list(uint32_t *n);
+
+/* Calls fn for every registered device, none of which can be freed
+   meanwhile. Returns -1 if any call failed. */
+int xcan_devices_foreach(int (*fn)(struct xcan_device *dev, void *arg), void *arg);
+
+int xcan_device_retry_stats(struct xcan_device *dev, struct xcan_retry_stats *stats);
+
+/* Frames parked on dev, from any thread */
+static inline uint32_t xcan_device_parked(struct xcan_device *dev)
+{
+    return atomic_load_explicit(&dev->retry.count, memory_order_relaxed);
+}
+
+/* Earliest time a parked frame of dev, or of any device, is due to be
+   retried, or 0 if none is parked */
+uint64_t xcan_device_retry_deadline(struct xcan_device *dev);
+
+uint64_t xcan_devices_retry_deadline(void);
+
 int xcan_device_link_state(struct xcan_device *dev);
 
 #endif /* XCAN_DEVICE_H */
@@ -0,0 +1,23 @@
+#ifndef XCAN_EVENT_H
+#define XCAN_EVENT_H
+
+#include "xcan_config.h"
+#include "xcan_device.h"
+
+/* Watches the file descriptors of devices providing get_fd() so the stack
+   only runs when a device has something to do. Devices without a file
+   descriptor are not watched. */
+
+int xcan_event_add(struct xcan_device *dev);
+
+void xcan_event_del(struct xcan_device *dev);
+
+/* Also wake up when the device can accept more output */
+int xcan_event_want_out(struct xcan_device *dev, bool want);
+
+/* Waits up to timeout_ms (-1 for ever) and fills ready with the IDs of up
+   to max devices that have input or an error pending. Returns the number
+   of IDs stored, or -1 on error. */
+int xcan_event_wait(uint8_t *ready, int max, int timeout_ms);
+
+#endif /* XCAN_EVENT_H */
@@ -2,7 +2,41 @@
 #define XCAN_FRAME_H
 
 #include "xcan_config.h"
+#include "xcan_pool.h"
 
+/* Flags and masks carried in xcan_frame.id, as used by SocketCAN */
+#define XCAN_EFF_FLAG   0x80000000U     /* Extended frame format (29 bit ID) */
+#define XCAN_RTR_FLAG   0x40000000U     /* Remote transmission request */
+#define XCAN_ERR_FLAG   0x20000000U     /* Error frame */
+
+#define XCAN_SFF_MASK   0x000007FFU
+#define XCAN_EFF_MASK   0x1FFFFFFFU
+
+#define XCAN_SFF_IDS    (XCAN_SFF_MASK + 1)
+
+#define XCAN_PAYLOAD_CAN    8
+#define XCAN_PAYLOAD_CANFD  64
+#define XCAN_PAYLOAD_XL     2048
+
+/* Route of a frame that was not routed or whose table entry has no index
+   that fits xcan_frame.route */
+#define XCAN_ROUTE_NONE     0xFFFF
+
+/* Stack options carried in xcan_frame.opts */
+#define XCAN_FRAME_COALESCE 0x01    /* Replaces a queued frame with the same ID */
+
+enum xcan_frame_pool {
+    XCAN_FRAME_POOL_DESC,   /* Descriptors without payload, used by copies */
+    XCAN_FRAME_POOL_CAN,    /* Frames with up to XCAN_PAYLOAD_CAN bytes */
+    XCAN_FRAME_POOL_CANFD,  /* Frames with up to XCAN_PAYLOAD_CANFD bytes */
+    XCAN_FRAME_POOL_XL,     /* Frames with up to XCAN_PAYLOAD_XL bytes */
+    XCAN_FRAME_POOLS
+};
+
+/* A frame is a cache line aligned header directly followed by its payload,
+   so a classic CAN frame fits a single cache line and a CAN FD frame two.
+   Copies made with xcan_frame_copy() are bare headers whose data pointer
+   refers to the payload of the frame that owns it. */
 struct xcan_frame {
 
     /* Connect for queues */
@@ -11,15 +45,32 @@ struct xcan_frame {
     /* Pointer to XCAN device this frame belongs to */
     struct xcan_device *dev;
 
+    uint8_t *data;  /* Frame payload buffer */
+
+    /* Frame holding the payload, which is this frame unless it is a copy */
+    struct xcan_frame *owner;
+
     uint32_t id;    /* 32 bit CAN_ID + EFF/RTR/ERR flags */
-    uint8_t  flags;  /* Flags */
     uint16_t len;   /* Frame payload length in bytes */
-    uint8_t *data;  /* Frame payload buffer */
-    
-    /* Pointer to frame usage count, which is stored in the last byte
-       after the frame buffer */
-    uint8_t *usage_count; 
-};
+    uint8_t  flags;  /* Flags */
+    uint8_t  pool;  /* Pool the frame was taken from */
+
+    /* Number of frames referencing this frame's payload. Updated atomically
+       so copies may be discarded from any thread. */
+    _Atomic uint32_t refcnt;
+
+    /* Routing table entry that sent this copy out, or XCAN_ROUTE_NONE */
+    uint16_t route;
+
+    uint8_t opts;   /* XCAN_FRAME_* options */
+
+    /* Monotonic nanoseconds (xcan_time_ns()). Frames are stamped when they
+       are received, copies when the router makes them; a copy's receive
+       time is that of its owner. 0 until stamped. */
+    uint64_t ts;
+
+    uint8_t payload[] __attribute__((aligned(8)));
+} XCAN_CACHE_ALIGNED;
 
 void xcan_frame_discard(struct xcan_frame *f);
 
@@ -29,4 +80,11 @@ struct xcan_frame* xcan_frame_copy(struct xcan_frame *f);
 
 struct xcan_frame* xcan_frame_deepcopy(struct xcan_frame *f);
 
+/* Makes dst, a frame sitting in a queue, carry the ID and payload of src
+   instead, and consumes src. Fails, leaving both untouched, if dst owns a
+   payload that is shared or too small for src. */
+int xcan_frame_replace(struct xcan_frame *dst, struct xcan_frame *src);
+
+int xcan_frame_pool_stats(enum xcan_frame_pool pool, struct xcan_pool_stats *stats);
+
 #endif
@@ -0,0 +1,85 @@
+#ifndef XCAN_LATENCY_H
+#define XCAN_LATENCY_H
+
+#include "xcan_config.h"
+#include "xcan_frame.h"
+#include "xcan_device.h"
+
+/* Latency histograms built from frame timestamps.
+
+   Every frame is stamped when it is received and every copy when the
+   router makes it, so the time a frame spends in the stack splits into
+
+     XCAN_LATENCY_RX     receive until routed: the wait in q_in plus the
+                         routing itself, kept for the receiving device
+     XCAN_LATENCY_TX     routed until sent: the wait in q_out and the
+                         driver's send, kept for the sending device
+     XCAN_LATENCY_TOTAL  receive until sent, kept for the sending device
+                         and for the routing table entry that routed it
+
+   Histograms are log-linear in the style of HdrHistogram: values below
+   2^XCAN_HIST_SUB_BITS ns are exact and above that each power of two is
+   split into 2^(XCAN_HIST_SUB_BITS - 1) buckets, so a percentile is within
+   about 6% of the true value. Each histogram has a single writer and can
+   be read from any thread at any time; a reading taken while frames are
+   forwarded may be a few frames out of step between fields. */
+
+#define XCAN_HIST_SUB_BITS  5
+#define XCAN_HIST_MAX_BITS  36      /* Values from about 68 s up share the last bucket */
+#define XCAN_HIST_BUCKETS   ((XCAN_HIST_MAX_BITS - XCAN_HIST_SUB_BITS + 2) << (XCAN_HIST_SUB_BITS - 1))
+
+enum xcan_latency_stage {
+    XCAN_LATENCY_RX,
+    XCAN_LATENCY_TX,
+    XCAN_LATENCY_TOTAL,
+    XCAN_LATENCY_STAGES
+};
+
+struct xcan_hist {
+    uint64_t count;
+    uint64_t sum;       /* ns */
+    uint64_t max;       /* ns */
+    uint32_t bucket[XCAN_HIST_BUCKETS];
+};
+
+/* Value in ns below which the given percentage (0 to 100) of samples lie,
+   rounded up to the top of its bucket. 0 for an empty histogram. */
+uint64_t xcan_hist_percentile(const struct xcan_hist *h, double percentile);
+
+/* Mean in ns, 0 for an empty histogram */
+uint64_t xcan_hist_mean(const struct xcan_hist *h);
+
+/* Copies the histogram of a stage for a device into out */
+int xcan_latency_device(uint8_t dev_id, enum xcan_latency_stage stage, struct xcan_hist *out);
+
+/* Copies the XCAN_LATENCY_TOTAL histogram of routing table entry `entry`,
+   over all sending devices, into out. Entries from XCAN_LATENCY_ROUTES on
+   are not tracked. */
+int xcan_latency_route(uint32_t entry, struct xcan_hist *out);
+
+/* Clears all histograms */
+void xcan_latency_reset(void);
+
+/* ------- Stack internal ------- */
+
+#if XCAN_LATENCY
+
+/* Sets up the histograms of a device, called when it registers */
+int xcan_latency_attach(struct xcan_device *dev);
+
+/* Records frame f, received on f->dev, as routed at time now */
+void xcan_latency_routed(struct xcan_frame *f, uint64_t now);
+
+/* Records n frames as sent by dev at time now */
+void xcan_latency_sent(struct xcan_device *dev, struct xcan_frame **f, uint32_t n, uint64_t now);
+
+#else
+
+static inline int xcan_latency_attach(struct xcan_device *dev) { return 0; }
+static inline void xcan_latency_routed(struct xcan_frame *f, uint64_t now) { }
+static inline void xcan_latency_sent(struct xcan_device *dev, struct xcan_frame **f,
+                                     uint32_t n, uint64_t now) { }
+
+#endif /* XCAN_LATENCY */
+
+#endif /* XCAN_LATENCY_H */
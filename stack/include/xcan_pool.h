@@ -0,0 +1,49 @@
+#ifndef XCAN_POOL_H
+#define XCAN_POOL_H
+
+#include "xcan_config.h"
+
+struct xcan_pool_stats {
+    uint32_t blocks;        /* Total number of blocks in the pool */
+    uint32_t in_use;        /* Blocks currently handed out */
+    uint32_t peak;          /* Highest value in_use has reached */
+    uint64_t allocs;        /* Successful allocations */
+    uint64_t frees;         /* Blocks returned to the pool */
+    uint64_t exhausted;     /* Allocations that failed because the pool was empty */
+};
+
+/* Fixed size block pool over caller supplied memory. Blocks are handed out
+   from a free list, falling back to carving never used blocks off the end
+   of the backing memory, so a pool needs no initialisation beyond
+   XCAN_POOL_INITIALIZER and both get and put are O(1).
+
+   The free list is a lock-free stack of block indices whose head carries a
+   generation tag against ABA, so blocks may be taken and returned from any
+   thread. */
+struct xcan_pool {
+    uint8_t *mem;
+    uint32_t block_size;
+    uint32_t blocks;
+    _Atomic uint32_t carved;        /* Blocks taken from mem at least once */
+    _Atomic uint64_t free_list;     /* Generation << 32 | (index + 1), 0 when empty */
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    _Atomic uint64_t exhausted;
+    _Atomic uint32_t peak;
+};
+
+#define XCAN_POOL_ALIGN(size) (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+#define XCAN_POOL_INITIALIZER(memory, size, count) {    \
+    .mem = (uint8_t *)(memory),                         \
+    .block_size = XCAN_POOL_ALIGN(size),                \
+    .blocks = (count)                                   \
+}
+
+void* xcan_pool_get(struct xcan_pool *p);
+
+void xcan_pool_put(struct xcan_pool *p, void *block);
+
+void xcan_pool_stats(struct xcan_pool *p, struct xcan_pool_stats *stats);
+
+#endif /* XCAN_POOL_H */
@@ -0,0 +1,161 @@
+#ifndef XCAN_PRIO_H
+#define XCAN_PRIO_H
+
+#include "xcan_config.h"
+#include "xcan_frame.h"
+
+/* Frames ordered the way CAN arbitration would send them: lowest ID first.
+
+   There is one bucket per 11 bit base ID and IDE bit, so a standard frame
+   goes before an extended frame with the same base ID just as on the bus.
+   A bit per bucket, summarised by a bit per 64 buckets, finds the first
+   non-empty bucket in two count-trailing-zeros.
+
+   Inside a bucket frames are kept sorted by the rest of the arbitration
+   field: the 18 low bits of an extended ID, then the RTR bit, so a data
+   frame goes before a remote frame of the same ID. Frames of equal rank
+   keep the order they came in. Insert is O(1) when a bucket's frames come
+   in that order, as cyclic traffic does, and otherwise linear in the
+   frames queued in the bucket; pop is always O(1). */
+
+#define XCAN_PRIO_BUCKETS   (2 * XCAN_SFF_IDS)
+#define XCAN_PRIO_WORDS     (XCAN_PRIO_BUCKETS / 64)
+
+struct xcan_prio_bucket {
+    struct xcan_frame *head;
+    struct xcan_frame *tail;
+};
+
+struct xcan_prio {
+    uint32_t frames;
+    uint64_t summary;                   /* Bit per non-empty word of map */
+    uint64_t map[XCAN_PRIO_WORDS];      /* Bit per non-empty bucket */
+    struct xcan_prio_bucket bucket[XCAN_PRIO_BUCKETS];
+};
+
+struct xcan_prio* xcan_prio_create(void);
+
+void xcan_prio_destroy(struct xcan_prio *p);
+
+static inline uint32_t xcan_prio_key(uint32_t can_id)
+{
+    if(can_id & XCAN_EFF_FLAG)
+        return (((can_id & XCAN_EFF_MASK) >> 18) << 1) | 1;
+
+    return (can_id & XCAN_SFF_MASK) << 1;
+}
+
+/* Order of a frame within its bucket, lowest first */
+static inline uint32_t xcan_prio_rank(uint32_t can_id)
+{
+    uint32_t rank = (can_id & XCAN_RTR_FLAG) ? 1 : 0;
+
+    if(can_id & XCAN_EFF_FLAG)
+        rank |= (can_id & 0x3FFFF) << 1;
+
+    return rank;
+}
+
+static inline uint32_t xcan_prio_count(struct xcan_prio *p)
+{
+    return p->frames;
+}
+
+static inline void xcan_prio_push(struct xcan_prio *p, struct xcan_frame *f)
+{
+    uint32_t key = xcan_prio_key(f->id);
+    uint32_t rank = xcan_prio_rank(f->id);
+    struct xcan_prio_bucket *b = &p->bucket[key];
+    struct xcan_frame **link;
+
+    p->frames++;
+    f->next = NULL;
+
+    if(!b->head) {
+        b->head = f;
+        b->tail = f;
+        p->map[key / 64] |= 1ULL << (key % 64);
+        p->summary |= 1ULL << (key / 64);
+        return;
+    }
+
+    if(xcan_prio_rank(b->tail->id) <= rank) {
+        b->tail->next = f;
+        b->tail = f;
+        return;
+    }
+
+    /* Ahead of the first frame that would lose arbitration to it, which
+       the tail guarantees exists */
+    for(link = &b->head ; xcan_prio_rank((*link)->id) <= rank ; link = &(*link)->next);
+
+    f->next = *link;
+    *link = f;
+}
+
+static inline struct xcan_prio_bucket* xcan_prio_first(struct xcan_prio *p)
+{
+    uint32_t word;
+
+    if(!p->summary)
+        return NULL;
+
+    word = __builtin_ctzll(p->summary);
+    return &p->bucket[word * 64 + __builtin_ctzll(p->map[word])];
+}
+
+static inline struct xcan_frame* xcan_prio_peek(struct xcan_prio *p)
+{
+    struct xcan_prio_bucket *b = xcan_prio_first(p);
+
+    return b ? b->head : NULL;
+}
+
+static inline struct xcan_frame* xcan_prio_pop(struct xcan_prio *p)
+{
+    struct xcan_prio_bucket *b = xcan_prio_first(p);
+    struct xcan_frame *f;
+    uint32_t key;
+
+    if(!b)
+        return NULL;
+
+    f = b->head;
+    b->head = f->next;
+
+    if(!b->head) {
+        b->tail = NULL;
+        key = b - p->bucket;
+        p->map[key / 64] &= ~(1ULL << (key % 64));
+        if(!p->map[key / 64])
+            p->summary &= ~(1ULL << (key / 64));
+    }
+
+    f->next = NULL;
+    p->frames--;
+    return f;
+}
+
+/* Copy up to n frames, highest priority first, into f without removing
+   them. Returns the number of frames copied. */
+static inline uint32_t xcan_prio_peek_bulk(struct xcan_prio *p, struct xcan_frame **f, uint32_t n)
+{
+    uint64_t summary = p->summary, map;
+    struct xcan_frame *cur;
+    uint32_t got = 0, word;
+
+    while(summary && got < n) {
+        word = __builtin_ctzll(summary);
+        summary &= summary - 1;
+
+        for(map = p->map[word] ; map && got < n ; map &= map - 1) {
+            cur = p->bucket[word * 64 + __builtin_ctzll(map)].head;
+            for( ; cur && got < n ; cur = cur->next)
+                f[got++] = cur;
+        }
+    }
+
+    return got;
+}
+
+#endif /* XCAN_PRIO_H */
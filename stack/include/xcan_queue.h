@@ -3,21 +3,181 @@
 
 #include "xcan_config.h"
 #include "xcan_frame.h"
+#include "xcan_ring.h"
+#include "xcan_prio.h"
+
+enum xcan_queue_type {
+    XCAN_QUEUE_LIST,    /* Linked through the frames, bounded by max_frames if set */
+    XCAN_QUEUE_RING,    /* Lock-free SPSC ring holding max_frames, rounded up to a power of two */
+    XCAN_QUEUE_PRIO,    /* Lowest CAN ID first (see xcan_prio.h), bounded by max_frames if set */
+};
+
+/* Why a frame offered to a queue did not leave it through a dequeue */
+enum xcan_queue_drop {
+    XCAN_QUEUE_DROP_FULL,       /* Refused, the queue held max_frames */
+    XCAN_QUEUE_DROP_COALESCED,  /* Merged into a queued frame of its ID (see xcan_queue_set_coalesce()) */
+    XCAN_QUEUE_DROP_FLUSHED,    /* Discarded by xcan_queue_empty() or xcan_queue_destroy() */
+    XCAN_QUEUE_DROPS
+};
+
+struct xcan_queue_stats {
+    uint32_t depth;         /* Frames queued now */
+    uint32_t high_water;    /* Most frames queued at once */
+    uint32_t max_frames;    /* Capacity, 0 if unbounded */
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t dropped[XCAN_QUEUE_DROPS];
+};
+
+/* Counters behind xcan_queue_stats(), compiled in with XCAN_STATS. Each
+   has a single writer: the producer of a ring writes the first three and
+   its consumer the rest, a cache line apart. */
+struct xcan_queue_counters {
+    _Atomic uint64_t enqueued;
+    _Atomic uint64_t full;
+    _Atomic uint64_t coalesced;
+    uint8_t pad[XCAN_CACHE_LINE];
+    _Atomic uint64_t dequeued;
+    _Atomic uint64_t flushed;
+    _Atomic uint32_t high_water;    /* For a ring, as seen by the consumer */
+};
+
+/* Queued frames marked XCAN_FRAME_COALESCE, by ID */
+struct xcan_queue_index;
 
 struct xcan_queue {
     uint32_t frames;
     uint32_t max_frames;
     struct xcan_frame *head;
     struct xcan_frame *tail;
+    struct xcan_ring *ring;     /* Set for XCAN_QUEUE_RING */
+    struct xcan_prio *prio;     /* Set for XCAN_QUEUE_PRIO */
+    struct xcan_queue_index *index;     /* Set for bounded list and priority queues */
+    bool coalesce;              /* Mark every frame enqueued XCAN_FRAME_COALESCE */
+    struct xcan_queue_counters count;
 };
 
+int xcan_queue_init(struct xcan_queue *q, enum xcan_queue_type type, uint32_t max_frames);
+
+void xcan_queue_destroy(struct xcan_queue *q);
+
+/* Reads the counters of q. May be called from any thread; a reading taken
+   while frames pass may be a few frames out of step between fields.
+
+   The high-water mark of a list or priority queue is exact. A ring only
+   learns its depth when the consumer looks at the producer's index, which
+   it does whenever it runs out of frames it knows of, so short peaks
+   between two looks can be missed; a ring that refused a frame reports
+   its capacity. */
+void xcan_queue_stats(struct xcan_queue *q, struct xcan_queue_stats *out);
+
+/* Zeroes the counters of q and restarts the high-water mark from the
+   current depth. A counter bumped at the same moment on another thread may
+   keep its old value. */
+void xcan_queue_reset_stats(struct xcan_queue *q);
+
+/* max_frames suggested for a queue that saw the traffic in s: twice the
+   high-water mark, at least XCAN_BURST, rounded up to a power of two. A
+   queue that refused frames only shows its max_frames was too small, so
+   twice that is suggested until a run goes without refusals. */
+uint32_t xcan_queue_suggest_frames(const struct xcan_queue_stats *s);
+
+/* Last value queueing. A frame marked XCAN_FRAME_COALESCE, by its route or
+   by a queue with coalescing turned on, that finds a marked frame with the
+   same ID queued takes that frame's place instead of joining the tail:
+   the queued frame is given the new payload and keeps its position. The
+   queue never holds more than one marked frame per ID, so cyclic signals
+   cannot fill it with stale values. Only bounded list and priority
+   queues coalesce. */
+int xcan_queue_set_coalesce(struct xcan_queue *q, bool coalesce);
+
+/* Index maintenance for marked frames, used by the inline functions */
+int xcan_queue_coalesce(struct xcan_queue *q, struct xcan_frame *f);
+
+void xcan_queue_index_add(struct xcan_queue *q, struct xcan_frame *f);
+
+void xcan_queue_index_del(struct xcan_queue *q, struct xcan_frame *f);
+
+#if XCAN_STATS
+
+/* Only the counter's own writer calls this, so no locked instruction is
+   needed */
+static inline void xcan_queue_count(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void xcan_queue_depth(struct xcan_queue *q, uint32_t depth)
+{
+    if(depth > atomic_load_explicit(&q->count.high_water, memory_order_relaxed))
+        atomic_store_explicit(&q->count.high_water, depth, memory_order_relaxed);
+}
+
+#else
+
+static inline void xcan_queue_count(_Atomic uint64_t *c, uint64_t n) { }
+static inline void xcan_queue_depth(struct xcan_queue *q, uint32_t depth) { }
+
+#endif /* XCAN_STATS */
+
+static inline bool xcan_frames_marked(struct xcan_frame **f, uint32_t n)
+{
+    for(uint32_t i = 0 ; i < n ; i++) {
+        if(f[i]->opts & XCAN_FRAME_COALESCE)
+            return true;
+    }
+
+    return false;
+}
+
+static inline bool xcan_queue_marked(struct xcan_queue *q, struct xcan_frame *f)
+{
+    if(q->coalesce)
+        f->opts |= XCAN_FRAME_COALESCE;
+
+    return q->index && (f->opts & XCAN_FRAME_COALESCE);
+}
+
 static inline int xcan_enqueue(struct xcan_queue *q, struct xcan_frame *f)
 {
+    bool marked;
+
+    if(q->ring) {
+        if(xcan_ring_push(q->ring, f) != 0) {
+            xcan_queue_count(&q->count.full, 1);
+            return -1;
+        }
+
+        xcan_queue_count(&q->count.enqueued, 1);
+        return 0;
+    }
+
+    /* Replace the queued value of the ID */
+    marked = xcan_queue_marked(q, f);
+    if(marked && xcan_queue_coalesce(q, f) == 0) {
+        xcan_queue_count(&q->count.coalesced, 1);
+        return 0;
+    }
+
     if((q->max_frames) &&  (q->frames >= q->max_frames)) {
         /* Queue full */
+        xcan_queue_count(&q->count.full, 1);
         return -1;
     }
 
+    if(marked)
+        xcan_queue_index_add(q, f);
+
+    xcan_queue_count(&q->count.enqueued, 1);
+
+    if(q->prio) {
+        xcan_prio_push(q->prio, f);
+        q->frames++;
+        xcan_queue_depth(q, q->frames);
+        return 0;
+    }
+
     f->next = NULL;
     if(!q->head) {
         /* Queue is empty */
@@ -31,46 +191,227 @@ static inline int xcan_enqueue(struct xcan_queue *q, struct xcan_frame *f)
     }
 
     q->frames++;
+    xcan_queue_depth(q, q->frames);
     return 0;
 }
 
-static inline struct xcan_frame* xcan_dequeue(struct xcan_queue *q)
+/* xcan_dequeue() without counting the frame as dequeued */
+static inline struct xcan_frame* xcan_queue_take(struct xcan_queue *q)
 {
     struct xcan_frame *f = q->head;
 
+    if(q->ring)
+        return xcan_ring_pop(q->ring);
+
+    if(q->prio) {
+        f = xcan_prio_pop(q->prio);
+        if(!f)
+            return NULL;
+
+        q->frames--;
+    } else {
+        if(!f)
+            return NULL;
+
+        if(q->frames < 1)
+            return NULL;
+
+        /* New head is 1 before frame */
+        q->head = f->next;
+        q->frames--;
+
+        if(q->head == NULL)
+            q->tail = NULL;
+
+        f->next = NULL;
+    }
+
+    if(q->index && (f->opts & XCAN_FRAME_COALESCE))
+        xcan_queue_index_del(q, f);
+
+    return f;
+}
+
+static inline struct xcan_frame* xcan_dequeue(struct xcan_queue *q)
+{
+    struct xcan_frame *f = xcan_queue_take(q);
+
     if(!f)
         return NULL;
-    
-    if(q->frames < 1)
-        return NULL;
-
-    /* New head is 1 before frame */
-    q->head = f->next;
-    q->frames--;
 
-    if(q->head == NULL)
-        q->tail = NULL;
+    if(q->ring)
+        xcan_queue_depth(q, xcan_ring_count_seen(q->ring) + 1);
 
-    f->next = NULL;
+    xcan_queue_count(&q->count.dequeued, 1);
     return f;
 }
 
 static inline struct xcan_frame* xcan_queue_peek(struct xcan_queue *q)
 {
     struct xcan_frame *f = q->head;
+
+    if(q->ring)
+        return xcan_ring_peek(q->ring);
+
+    if(q->prio)
+        return xcan_prio_peek(q->prio);
+
     if(q->frames < 1)
         return NULL;
     
     return f;
 }
 
+/* Enqueue up to n frames, stopping when the queue is full. Returns the
+   number of frames enqueued, which are always the first ones of f. */
+static inline uint32_t xcan_enqueue_bulk(struct xcan_queue *q, struct xcan_frame **f, uint32_t n)
+{
+    uint32_t offered = n;
+
+    if(q->ring) {
+        n = xcan_ring_push_bulk(q->ring, f, n);
+        xcan_queue_count(&q->count.enqueued, n);
+        if(n < offered)
+            xcan_queue_count(&q->count.full, offered - n);
+        return n;
+    }
+
+    /* Frames to coalesce go one at a time */
+    if(q->index && (q->coalesce || xcan_frames_marked(f, n))) {
+        uint32_t i = 0;
+
+        while(i < n && xcan_enqueue(q, f[i]) == 0)
+            i++;
+
+        /* The one that failed is counted already */
+        if(i + 1 < n)
+            xcan_queue_count(&q->count.full, n - i - 1);
+        return i;
+    }
+
+    if((q->max_frames) && (n > q->max_frames - q->frames)) {
+        n = q->max_frames - q->frames;
+        xcan_queue_count(&q->count.full, offered - n);
+    }
+
+    if(n == 0)
+        return 0;
+
+    xcan_queue_count(&q->count.enqueued, n);
+
+    if(q->prio) {
+        for(uint32_t i = 0 ; i < n ; i++)
+            xcan_prio_push(q->prio, f[i]);
+        q->frames += n;
+        xcan_queue_depth(q, q->frames);
+        return n;
+    }
+
+    /* Chain the frames together, then splice the chain onto the tail */
+    for(uint32_t i = 0 ; i < n - 1 ; i++)
+        f[i]->next = f[i + 1];
+    f[n - 1]->next = NULL;
+
+    if(!q->head) {
+        q->head = f[0];
+        q->frames = 0;
+    } else {
+        q->tail->next = f[0];
+    }
+
+    q->tail = f[n - 1];
+    q->frames += n;
+    xcan_queue_depth(q, q->frames);
+    return n;
+}
+
+/* Dequeue up to n frames from the head into f, in priority order for
+   XCAN_QUEUE_PRIO. Returns the number of frames
+   dequeued. */
+static inline uint32_t xcan_dequeue_bulk(struct xcan_queue *q, struct xcan_frame **f, uint32_t n)
+{
+    struct xcan_frame *cur = q->head;
+
+    if(q->ring) {
+        n = xcan_ring_pop_bulk(q->ring, f, n);
+        if(n) {
+            xcan_queue_depth(q, xcan_ring_count_seen(q->ring) + n);
+            xcan_queue_count(&q->count.dequeued, n);
+        }
+        return n;
+    }
+
+    if(n > q->frames)
+        n = q->frames;
+
+    if(q->prio) {
+        for(uint32_t i = 0 ; i < n ; i++)
+            f[i] = xcan_prio_pop(q->prio);
+        q->frames -= n;
+    } else {
+        for(uint32_t i = 0 ; i < n ; i++) {
+            f[i] = cur;
+            cur = cur->next;
+            f[i]->next = NULL;
+        }
+
+        /* Unlink the whole chain at once */
+        q->head = cur;
+        q->frames -= n;
+
+        if(q->head == NULL)
+            q->tail = NULL;
+    }
+
+    if(q->index) {
+        for(uint32_t i = 0 ; i < n ; i++) {
+            if(f[i]->opts & XCAN_FRAME_COALESCE)
+                xcan_queue_index_del(q, f[i]);
+        }
+    }
+
+    xcan_queue_count(&q->count.dequeued, n);
+    return n;
+}
+
+/* Copy up to n frames from the head into f without dequeuing them. */
+static inline uint32_t xcan_queue_peek_bulk(struct xcan_queue *q, struct xcan_frame **f, uint32_t n)
+{
+    struct xcan_frame *cur = q->head;
+
+    if(q->ring)
+        return xcan_ring_peek_bulk(q->ring, f, n);
+
+    if(q->prio)
+        return xcan_prio_peek_bulk(q->prio, f, n);
+
+    if(n > q->frames)
+        n = q->frames;
+
+    for(uint32_t i = 0 ; i < n ; i++) {
+        f[i] = cur;
+        cur = cur->next;
+    }
+
+    return n;
+}
+
+static inline uint32_t xcan_queue_len(struct xcan_queue *q)
+{
+    if(q->ring)
+        return xcan_ring_count(q->ring);
+
+    return q->frames;
+}
+
 static inline void xcan_queue_empty(struct xcan_queue *q)
 {
-    struct xcan_frame *f = xcan_dequeue(q);
+    struct xcan_frame *f = xcan_queue_take(q);
     while(f) {
+        xcan_queue_count(&q->count.flushed, 1);
         xcan_frame_discard(f);
-        f = xcan_dequeue(q);
+        f = xcan_queue_take(q);
     }
 }
 
-#endif /* XCAN_QUEUE_H */
\ No newline at end of file
+#endif /* XCAN_QUEUE_H */
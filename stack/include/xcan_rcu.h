@@ -0,0 +1,28 @@
+#ifndef XCAN_RCU_H
+#define XCAN_RCU_H
+
+#include "xcan_config.h"
+
+/* Quiescent state based reclamation for data read on the forwarding path.
+
+   Readers load a shared pointer with acquire semantics and use it without
+   locks. Between uses, each reader thread reports a quiescent state, a
+   point where it holds no such pointer. Writers publish a replacement
+   atomically and retire the old object, which is freed only once every
+   online reader has reported a quiescent state since. Reader threads
+   register themselves by going online and must go offline before
+   blocking for long or exiting. */
+
+void xcan_rcu_online(void);
+
+void xcan_rcu_offline(void);
+
+void xcan_rcu_quiescent(void);
+
+/* Hand ptr over to be passed to free_fn once no reader can hold it */
+int xcan_rcu_retire(void *ptr, void (*free_fn)(void *ptr));
+
+/* Free what is safe to free; returns the number of objects still pending */
+int xcan_rcu_reclaim(void);
+
+#endif /* XCAN_RCU_H */
@@ -0,0 +1,151 @@
+#ifndef XCAN_RING_H
+#define XCAN_RING_H
+
+#include "xcan_config.h"
+#include "xcan_frame.h"
+
+/* Fixed capacity single-producer/single-consumer ring of frame pointers.
+   Producer and consumer indices live on their own cache lines, and each
+   side keeps a cached copy of the other's index so the shared line is only
+   read when the ring looks full or empty. One thread may push while another
+   pops without locks; the frames themselves are never touched. */
+struct xcan_ring {
+    /* Producer */
+    _Atomic uint32_t tail XCAN_CACHE_ALIGNED;
+    uint32_t head_cache;
+
+    /* Consumer */
+    _Atomic uint32_t head XCAN_CACHE_ALIGNED;
+    uint32_t tail_cache;
+
+    /* Read only after creation */
+    uint32_t mask XCAN_CACHE_ALIGNED;
+    struct xcan_frame *slot[];
+};
+
+struct xcan_ring* xcan_ring_create(uint32_t capacity);
+
+void xcan_ring_destroy(struct xcan_ring *r);
+
+static inline uint32_t xcan_ring_capacity(struct xcan_ring *r)
+{
+    return r->mask + 1;
+}
+
+/* Any thread. The head is read before the tail so the consumer cannot pass
+   the tail in between; the producer may still move on, so the count is
+   capped at the capacity. */
+static inline uint32_t xcan_ring_count(struct xcan_ring *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint32_t count = atomic_load_explicit(&r->tail, memory_order_acquire) - head;
+
+    return (count > r->mask) ? r->mask + 1 : count;
+}
+
+/* Consumer only. Frames queued when the consumer last looked at the
+   producer's index, without looking again. */
+static inline uint32_t xcan_ring_count_seen(struct xcan_ring *r)
+{
+    return r->tail_cache - atomic_load_explicit(&r->head, memory_order_relaxed);
+}
+
+/* Producer only */
+static inline int xcan_ring_push(struct xcan_ring *r, struct xcan_frame *f)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if(tail - r->head_cache > r->mask) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if(tail - r->head_cache > r->mask) {
+            /* Ring full */
+            return -1;
+        }
+    }
+
+    r->slot[tail & r->mask] = f;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/* Consumer only */
+static inline struct xcan_frame* xcan_ring_peek(struct xcan_ring *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if(head == r->tail_cache) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if(head == r->tail_cache)
+            return NULL;
+    }
+
+    return r->slot[head & r->mask];
+}
+
+/* Consumer only */
+static inline struct xcan_frame* xcan_ring_pop(struct xcan_ring *r)
+{
+    struct xcan_frame *f = xcan_ring_peek(r);
+
+    if(f) {
+        atomic_store_explicit(&r->head,
+                              atomic_load_explicit(&r->head, memory_order_relaxed) + 1,
+                              memory_order_release);
+    }
+
+    return f;
+}
+
+/* Producer only. Pushes as many of the n frames as fit and publishes them
+   with a single index update. */
+static inline uint32_t xcan_ring_push_bulk(struct xcan_ring *r, struct xcan_frame **f, uint32_t n)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t space = xcan_ring_capacity(r) - (tail - r->head_cache);
+
+    if(space < n) {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        space = xcan_ring_capacity(r) - (tail - r->head_cache);
+        if(n > space)
+            n = space;
+    }
+
+    for(uint32_t i = 0 ; i < n ; i++)
+        r->slot[(tail + i) & r->mask] = f[i];
+
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    return n;
+}
+
+/* Consumer only. Copies up to n frames from the head without removing them. */
+static inline uint32_t xcan_ring_peek_bulk(struct xcan_ring *r, struct xcan_frame **f, uint32_t n)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if(r->tail_cache - head < n) {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if(r->tail_cache - head < n)
+            n = r->tail_cache - head;
+    }
+
+    for(uint32_t i = 0 ; i < n ; i++)
+        f[i] = r->slot[(head + i) & r->mask];
+
+    return n;
+}
+
+/* Consumer only. Pops up to n frames with a single index update. */
+static inline uint32_t xcan_ring_pop_bulk(struct xcan_ring *r, struct xcan_frame **f, uint32_t n)
+{
+    n = xcan_ring_peek_bulk(r, f, n);
+
+    if(n) {
+        atomic_store_explicit(&r->head,
+                              atomic_load_explicit(&r->head, memory_order_relaxed) + n,
+                              memory_order_release);
+    }
+
+    return n;
+}
+
+#endif /* XCAN_RING_H */
@@ -3,6 +3,7 @@
 
 #include "xcan_config.h"
 #include "xcan_frame.h"
+#include "xcan_device.h"
 
 
 struct xcan_routing_table {
@@ -10,17 +11,41 @@ struct xcan_routing_table {
     uint32_t no_entries;
 };
 
+/* Frames are never routed back to the device they were received on.
+
+   An entry matches a single CAN ID, every ID whose bits under can_mask
+   equal those of can_id, or the range of IDs from can_id to can_id_last.
+   Where entries overlap, the one matching the fewest IDs wins and ties go
+   to the earlier entry. */
 struct xcan_routing_entry {
-    uint32_t can_id;
+    uint32_t can_id;        /* Set XCAN_EFF_FLAG for 29 bit IDs */
+    uint32_t can_mask;      /* ID bits that must match; 0 means every ID bit must match (single ID) */
+    uint32_t can_id_last;   /* Last ID of a range, takes precedence over can_mask */
     uint8_t *interface_id;
     uint8_t no_interfaces;
+    bool coalesce;          /* Newer frames replace queued ones of the same ID */
 };
 
+/* Compiles the routing table into the router's lookup structures; the table
+   is not referenced afterwards. */
 int xcan_router_init(struct xcan_routing_table *routing_table);
 
-int xcan_router_receive(struct xcan_frame *f);
+/* Replaces the routes of a running stack. The new table is compiled by the
+   calling thread and published atomically, so forwarding never stops or
+   takes a lock. The previous table is freed once the routing loop has
+   passed a quiescent point, either by a later update or by
+   xcan_rcu_reclaim(). */
+int xcan_router_update(struct xcan_routing_table *routing_table);
+
+/* Installs the receive filters the current routes need on dev. Done for
+   every device on each update; devices registering later call this. */
+int xcan_router_filter_device(struct xcan_device *dev);
 
+/* Returns the devices a frame with can_id is routed to */
+xcan_devmask_t xcan_router_lookup(uint32_t can_id);
+
+int xcan_router_receive(struct xcan_frame *f);
 
-int xcan_router_loop(int loop_score);
+int xcan_router_receive_bulk(struct xcan_frame **f, int n);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "xcan_config.h"
 #include "xcan_device.h"
+#include "xcan_router.h"
 
 /*******************************************************************************
  *  DATALINK LAYER
@@ -10,6 +11,8 @@
 
 int xcan_datalink_receive(struct xcan_frame *f);
 
+int xcan_datalink_receive_bulk(struct xcan_frame **f, int n);
+
 int xcan_datalink_send(struct xcan_frame *f);
 
 /*******************************************************************************
@@ -22,15 +25,52 @@ int xcan_stack_recv(struct xcan_device * dev,
                     uint8_t      const * data,
                     uint8_t              len);
 
-
-
-int xcan_sendto_dev()
+int xcan_stack_recv_bulk(struct xcan_device * dev,
+                         struct xcan_frame ** f,
+                         int                  n);
 
 
 /* ------- Initialisation ------- */
 int xcan_stack_init(struct xcan_routing_table *routing_table);
 
 /* ------- Loop Function -------- */
+
+/* Account of the last tick, and totals since start */
+struct xcan_tick_stats {
+    uint64_t budget_ns;     /* Budget of the tick */
+    uint64_t used_ns;       /* Time the tick took */
+    uint64_t rx_ns;         /* Time receiving and routing */
+    uint64_t tx_ns;         /* Time sending */
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+    uint32_t rx_share;      /* Per mille of the next budget for receiving and routing */
+    uint64_t ticks;
+    uint64_t overruns;      /* Ticks that went over budget */
+};
+
+/* Receives, routes and sends for up to the tick budget. Receiving and
+   routing get a share of the budget and sending the rest, and time one
+   side does not need goes to the other. The share follows the backlog of
+   the input and output queues from tick to tick. The clock is read every
+   XCAN_TICK_SLICE frames, so a tick overruns by at most that many frames. */
 void xcan_stack_tick(void);
 
+/* Sets the tick budget, XCAN_TICK_BUDGET_US by default */
+int xcan_stack_set_tick_budget(uint32_t budget_us);
+
+/* To be read from the thread calling xcan_stack_tick() */
+void xcan_stack_tick_stats(struct xcan_tick_stats *stats);
+
+/* ------- Event Loop -------- */
+
+/* Sleeps until a device is ready or timeout_ms (-1 for ever) expires, then
+   receives, routes and sends what is ready. Returns the number of devices
+   that became ready, or -1 on error.
+
+   The calling thread is an online RCU reader (see xcan_rcu.h) when this
+   returns, except while it sleeps inside. A thread that stops polling
+   must call xcan_rcu_offline(), or removed devices and old routing tables
+   are never freed. The same applies to xcan_stack_tick(). */
+int xcan_stack_poll(int timeout_ms);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,160 @@
+#ifndef XCAN_STATS_H
+#define XCAN_STATS_H
+
+#include "xcan_config.h"
+#include "xcan_frame.h"
+#include "xcan_device.h"
+
+/* Counters per device and per routing table entry.
+
+   Every counter has a single writer and is bumped with a relaxed load and
+   store, never a locked read-modify-write. The counters of a device are
+   split into one cache line per writer, so in the threaded pipeline (see
+   xcan_thread.h) the receive, routing and send threads never share a line:
+
+     rx     frames and bytes the driver handed in and those q_in had no
+            room for, written by whoever polls the device
+     route  frames routed or not from the device and copies meant for it
+            that were lost, written by the router
+     tx     frames and bytes sent and send failures, written by whoever
+            sends for the device
+
+   The counters live in one segment laid out as struct xcan_stats_segment.
+   It starts in process memory and xcan_stats_export() moves it into POSIX
+   shared memory, where xcan-stat (tools/xcan_stat.c), or anything else
+   that maps it read only, watches them live. Readers find the arrays
+   through the offsets and sizes in the header and check its version. */
+
+/* Shared memory object exported by the example gateway */
+#define XCAN_STATS_SHM      "/xcan-stats"
+
+#define XCAN_STATS_MAGIC    0x544154534E414358ULL   /* "XCANSTAT" */
+#define XCAN_STATS_VERSION  1
+
+struct xcan_stats_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t size;          /* Bytes in the segment */
+    uint32_t dev_offset;    /* Device counters, from the start of the segment */
+    uint32_t dev_size;      /* Bytes per device */
+    uint32_t dev_count;
+    uint32_t route_offset;  /* Route counters, from the start of the segment */
+    uint32_t route_size;    /* Bytes per route */
+    uint32_t route_count;
+    uint32_t pid;           /* Process writing the counters */
+    uint64_t start_ns;      /* xcan_time_ns() when the segment was set up */
+};
+
+struct xcan_stats_dev {
+    _Atomic uint32_t present;   /* 1 while a device has this ID */
+    char name[XCAN_MAX_DEVICE_NAME];
+
+    struct {
+        _Atomic uint64_t frames;
+        _Atomic uint64_t bytes;
+        _Atomic uint64_t bits;          /* Nominal bits on the bus, see xcan_frame_bits() */
+        _Atomic uint64_t queue_full;    /* Dropped, q_in full */
+    } rx XCAN_CACHE_ALIGNED;
+
+    struct {
+        _Atomic uint64_t routed;        /* Received frames sent on to another device */
+        _Atomic uint64_t unrouted;      /* Received frames with nowhere to go */
+        _Atomic uint64_t queue_full;    /* Copies for this device dropped, q_out full */
+        _Atomic uint64_t no_frame;      /* Copies for this device not made, pool empty */
+    } route XCAN_CACHE_ALIGNED;
+
+    struct {
+        _Atomic uint64_t frames;
+        _Atomic uint64_t bytes;
+        _Atomic uint64_t bits;
+        _Atomic uint64_t failed;        /* Attempts the driver failed, first tries and retries */
+        _Atomic uint64_t dropped;       /* Frames dropped after XCAN_RETRY_LIMIT retries */
+    } tx XCAN_CACHE_ALIGNED;
+};
+
+struct xcan_stats_route {
+    _Atomic uint64_t frames;        /* Frames the entry routed */
+    _Atomic uint64_t copies;        /* Copies made, one per destination */
+    _Atomic uint64_t queue_full;    /* Copies dropped, q_out full */
+    _Atomic uint64_t no_frame;      /* Copies not made, pool empty */
+} XCAN_CACHE_ALIGNED;
+
+struct xcan_stats_segment {
+    struct xcan_stats_header hdr XCAN_CACHE_ALIGNED;
+    struct xcan_stats_dev dev[XCAN_MAX_DEVICES];
+    struct xcan_stats_route route[XCAN_STATS_ROUTES];
+};
+
+/* Moves the counters into the POSIX shared memory object name (e.g.
+   XCAN_STATS_SHM), created or replaced, keeping their values. Call before
+   frames are forwarded, and before the threaded pipeline is started. */
+int xcan_stats_export(const char *name);
+
+/* Moves the counters back into process memory and removes the shared
+   memory object. Same restrictions as xcan_stats_export(). */
+void xcan_stats_unexport(void);
+
+/* The segment the counters are in, for reading in process */
+const struct xcan_stats_segment* xcan_stats_get(void);
+
+/* Zeroes all counters. A counter bumped at the same moment on another
+   thread may keep its old value. */
+void xcan_stats_reset(void);
+
+/* ------- Stack internal ------- */
+
+#if XCAN_STATS
+
+extern struct xcan_stats_segment *xcan_stats_seg;
+
+/* Single writer, so no locked instruction is needed */
+static inline void xcan_stats_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline struct xcan_stats_dev* xcan_stats_dev(uint8_t id)
+{
+    return &xcan_stats_seg->dev[id];
+}
+
+static inline struct xcan_stats_route* xcan_stats_route(uint16_t route)
+{
+    return (route < XCAN_STATS_ROUTES) ? &xcan_stats_seg->route[route] : NULL;
+}
+
+/* Zeroes the counters of a device and names it, called when it registers */
+void xcan_stats_attach(struct xcan_device *dev);
+
+/* Called when a device is removed */
+void xcan_stats_detach(struct xcan_device *dev);
+
+/* Counts n frames received on dev, before they are queued */
+void xcan_stats_received(struct xcan_device *dev, struct xcan_frame **f, uint32_t n);
+
+/* Counts n frames sent by dev */
+void xcan_stats_sent(struct xcan_device *dev, struct xcan_frame **f, uint32_t n);
+
+#define xcan_stats_inc(dev_id, line, counter, n) \
+    xcan_stats_add(&xcan_stats_dev(dev_id)->line.counter, (n))
+
+#define xcan_stats_route_inc(route, counter, n) do {                \
+        struct xcan_stats_route *r_ = xcan_stats_route(route);      \
+        if(r_)                                                      \
+            xcan_stats_add(&r_->counter, (n));                      \
+    } while(0)
+
+#else
+
+static inline void xcan_stats_attach(struct xcan_device *dev) { }
+static inline void xcan_stats_detach(struct xcan_device *dev) { }
+static inline void xcan_stats_received(struct xcan_device *dev, struct xcan_frame **f, uint32_t n) { }
+static inline void xcan_stats_sent(struct xcan_device *dev, struct xcan_frame **f, uint32_t n) { }
+
+#define xcan_stats_inc(dev_id, line, counter, n)    do { } while(0)
+#define xcan_stats_route_inc(route, counter, n)     do { } while(0)
+
+#endif /* XCAN_STATS */
+
+#endif /* XCAN_STATS_H */
@@ -0,0 +1,51 @@
+#ifndef XCAN_THREAD_H
+#define XCAN_THREAD_H
+
+#include "xcan_config.h"
+#include "xcan_device.h"
+
+/* Threaded pipeline, an alternative to driving the stack with
+   xcan_stack_tick() or xcan_stack_poll() from a single thread.
+
+   Every device gets a receive thread and a send thread, and a single
+   routing thread sits in between:
+
+     receive thread   polls its driver into q_in, now a ring
+     routing thread   drains every q_in through the router, which delivers
+                      to a ring per device instead of q_out
+     send thread      moves its ring into q_out, so priority and coalescing
+                      still apply, and sends and retries from there
+
+   Every ring has one producer and one consumer, so no stage takes a lock.
+   Threads sleep on their device, or on an eventfd that is only written
+   when the thread is actually asleep. A full ring holds the receive thread
+   back, leaving the frames in the driver, and a send thread blocked on a
+   slow bus only ever fills its own ring, so one slow device never stalls
+   the others.
+
+   The devices are those registered when the pipeline starts, and none may
+   be added or removed until it stops. Their drivers must receive from
+   poll() only. Coalescing on the input queues is lost, as q_in becomes a
+   ring and stays one after the pipeline stops. Nothing else may drive the
+   stack meanwhile, though the routing table may be updated. */
+
+struct xcan_thread_config {
+    int route_cpu;                      /* CPU of the routing thread */
+    int rx_cpu[XCAN_MAX_DEVICES];       /* CPU of each receive thread, by device ID */
+    int tx_cpu[XCAN_MAX_DEVICES];       /* CPU of each send thread, by device ID */
+    uint32_t ring_frames;               /* Depth of the rings, 0 for XCAN_DEVICE_QUEUE_FRAMES */
+};
+
+/* Leaves every thread free to run on any CPU; -1 stands for no affinity */
+void xcan_thread_config_init(struct xcan_thread_config *cfg);
+
+/* Starts the pipeline; cfg may be NULL for the defaults */
+int xcan_thread_start(const struct xcan_thread_config *cfg);
+
+/* Stops and joins every thread. Frames routed but not yet sent are moved
+   to q_out. */
+void xcan_thread_stop(void);
+
+bool xcan_thread_running(void);
+
+#endif /* XCAN_THREAD_H */
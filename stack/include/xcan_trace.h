@@ -0,0 +1,118 @@
+#ifndef XCAN_TRACE_H
+#define XCAN_TRACE_H
+
+#include "xcan_config.h"
+#include "xcan_time.h"
+
+/* Tracepoints for the forwarding path.
+
+   xcan_trace() stores a fixed size binary record in a ring owned by the
+   calling thread: a clock read, four stores and a release, with no
+   formatting, locks or system calls. Rings hold the last XCAN_TRACE_RING
+   records of their thread and overwrite the oldest when full; the reader
+   gets at most XCAN_TRACE_RING - 1 of them, as the slot the thread may be
+   writing is never passed on. A single reader, on any thread, collects
+   what it has not seen yet with xcan_trace_read() and formats it with
+   xcan_trace_format() whenever it suits.
+
+   Tracing is compiled in with XCAN_TRACE=1 (the XCAN_TRACE CMake option).
+   Without it xcan_trace() expands to nothing and its arguments are not
+   evaluated. */
+
+#ifndef XCAN_TRACE
+#define XCAN_TRACE  0
+#endif
+
+/* Records kept per thread, a power of two */
+#ifndef XCAN_TRACE_RING
+#define XCAN_TRACE_RING         4096
+#endif
+
+/* Threads that may trace at the same time */
+#ifndef XCAN_TRACE_MAX_THREADS
+#define XCAN_TRACE_MAX_THREADS  32
+#endif
+
+/* What a and b of a record hold is given for each point */
+enum xcan_trace_point {
+    XCAN_TRACE_DEV_RECV,        /* Frames received in one go, frames asked for */
+    XCAN_TRACE_DEV_SEND,        /* CAN ID, bytes written */
+    XCAN_TRACE_DEV_SEND_BULK,   /* Frames sent, frames offered */
+    XCAN_TRACE_RX_DROP,         /* Frames q_in had no room for, frames received */
+    XCAN_TRACE_TX_DROP,         /* CAN ID of a copy q_out had no room for, source device */
+    XCAN_TRACE_RETRY_PARK,      /* CAN ID, 1 if it failed or 0 if held behind one that did */
+    XCAN_TRACE_RETRY_DROP,      /* CAN ID, attempts */
+    XCAN_TRACE_POINTS
+};
+
+struct xcan_trace_record {
+    uint64_t ts;        /* xcan_time_ns() */
+    uint32_t a;
+    uint32_t b;
+    uint16_t point;     /* enum xcan_trace_point */
+    uint8_t dev;        /* Device ID */
+    uint8_t thread;     /* Ring the record was written to */
+};
+
+struct xcan_trace_ring {
+    _Atomic uint64_t head;      /* Records written, by the owning thread */
+    uint64_t tail XCAN_CACHE_ALIGNED;   /* Records read, by the reader */
+    uint8_t index;
+    _Atomic bool used;
+    struct xcan_trace_record rec[XCAN_TRACE_RING] XCAN_CACHE_ALIGNED;
+};
+
+#if XCAN_TRACE
+
+extern _Thread_local struct xcan_trace_ring *xcan_trace_self;
+
+/* Claims a ring for the calling thread, NULL if none is free */
+struct xcan_trace_ring* xcan_trace_attach(void);
+
+/* Hands the ring of the calling thread back, to be called before the
+   thread exits. Records not read yet stay in the ring. */
+void xcan_trace_detach(void);
+
+static inline void xcan_trace_write(uint16_t point, uint8_t dev, uint32_t a, uint32_t b)
+{
+    struct xcan_trace_ring *r = xcan_trace_self ? xcan_trace_self : xcan_trace_attach();
+    struct xcan_trace_record *rec;
+    uint64_t head;
+
+    if(!r)
+        return;
+
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    rec = &r->rec[head & (XCAN_TRACE_RING - 1)];
+    rec->ts = xcan_time_ns();
+    rec->a = a;
+    rec->b = b;
+    rec->point = point;
+    rec->dev = dev;
+    rec->thread = r->index;
+
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+#define xcan_trace(point, dev, a, b)    xcan_trace_write((point), (dev), (a), (b))
+
+#else
+
+static inline void xcan_trace_detach(void) { }
+
+#define xcan_trace(point, dev, a, b)    do { } while(0)
+
+#endif /* XCAN_TRACE */
+
+/* Passes every record written since the last call to fn, oldest first for
+   each thread. Records overwritten before they could be read are counted
+   in *lost if lost is not NULL. Returns the number of records passed on.
+   Only one thread may read at a time. */
+int xcan_trace_read(void (*fn)(const struct xcan_trace_record *rec, void *arg), void *arg,
+                    uint64_t *lost);
+
+/* Formats a record as a line of text without the newline. Returns the
+   length as snprintf() does. */
+int xcan_trace_format(const struct xcan_trace_record *rec, char *buf, size_t len);
+
+#endif /* XCAN_TRACE_H */
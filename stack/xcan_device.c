@@ -1,55 +1,359 @@
 #include "xcan_device.h"
 #include "xcan_stack.h"
+#include "xcan_event.h"
+#include "xcan_latency.h"
+#include "xcan_stats.h"
+#include "xcan_time.h"
+#include "xcan_rcu.h"
+#include "xcan_trace.h"
 
-struct xcan_device *devices[XCAN_MAX_DEVICES];
+/* Registered devices, indexed by ID for lookups and listed densely for
+   loops. A table is never changed once published: registering or removing
+   a device publishes a new one and retires the old through xcan_rcu, so
+   the forwarding loop reads it without locks. */
+struct device_table {
+    uint32_t no_ids;                /* Highest registered ID + 1 */
+    uint32_t no_active;
+    struct xcan_device **by_id;     /* no_ids entries, NULL where unused */
+    struct xcan_device *active[];
+};
 
-static int devloop_in(struct xcan_device *dev, int loop_score)
+static struct device_table m_empty;
+static struct device_table *_Atomic m_table = &m_empty;
+
+/* Serialises changes to the registry */
+static atomic_flag m_registry_lock = ATOMIC_FLAG_INIT;
+
+/* Round robin position of each direction, so the devices after the one
+   the budget ran out on go first next time */
+static uint32_t m_cursor[2];
+
+/* ------- Scheduling ------- */
+
+static inline uint32_t sched_cost(uint8_t unit, struct xcan_frame *f)
 {
-    struct xcan_frame *f;
+    return (unit == XCAN_SCHED_FRAMES) ? 1 : xcan_frame_bits(f);
+}
+
+/* Returns how many of the n frames of f the device's deficit pays for, and
+   charges it for them */
+static uint32_t sched_take(struct xcan_device *dev, int dir, struct xcan_frame **f, uint32_t n)
+{
+    struct xcan_device_sched *s = &dev->sched;
+    uint32_t i, cost;
+
+    if(s->unit[dir] == XCAN_SCHED_FRAMES) {
+        if(s->deficit[dir] < n)
+            n = (s->deficit[dir] > 0) ? s->deficit[dir] : 0;
+        s->deficit[dir] -= n;
+        return n;
+    }
+
+    for(i = 0 ; i < n ; i++) {
+        cost = sched_cost(s->unit[dir], f[i]);
+        if(cost > s->deficit[dir])
+            break;
+        s->deficit[dir] -= cost;
+    }
+
+    return i;
+}
+
+static void sched_refund(struct xcan_device *dev, int dir, struct xcan_frame **f, uint32_t n)
+{
+    for(uint32_t i = 0 ; i < n ; i++)
+        dev->sched.deficit[dir] += sched_cost(dev->sched.unit[dir], f[i]);
+}
+
+/* Frames the driver may read ahead into the input queue */
+static int sched_poll_budget(struct xcan_device *dev, int loop_score)
+{
+    struct xcan_device_sched *s = &dev->sched;
+    int64_t frames = s->deficit[XCAN_LOOP_DIR_IN];
+
+    if(s->unit[XCAN_LOOP_DIR_IN] == XCAN_SCHED_BITS)
+        frames /= XCAN_SCHED_SFF_BITS;
+
+    return (frames < loop_score) ? frames : loop_score;
+}
+
+static bool sched_backlog(struct xcan_device *dev, int dir)
+{
+    if(dir == XCAN_LOOP_DIR_IN)
+        return xcan_queue_len(dev->q_in) > 0;
+
+    return xcan_queue_len(dev->q_out) > 0 || xcan_device_parked(dev) > 0;
+}
+
+/* ------- Device loops ------- */
+
+/* With sched set the device's deficit limits what it may receive */
+static int devloop_in(struct xcan_device *dev, int loop_score, bool sched)
+{
+    struct xcan_frame *f[XCAN_BURST];
+    uint32_t n;
 
     if(!dev)
         return loop_score;
 
+    /* Let the driver fill the input queue */
+    if(dev->poll)
+        dev->poll(dev, sched ? sched_poll_budget(dev, loop_score) : loop_score);
+
     while(loop_score > 0)
     {
-        if(dev->q_in->frames == 0)
-            break;
+        n = (loop_score < XCAN_BURST) ? loop_score : XCAN_BURST;
 
-        f = xcan_dequeue(dev->q_in);
-        if(f) {
-            xcan_datalink_receive(f);
-            loop_score--;
+        if(sched) {
+            n = xcan_queue_peek_bulk(dev->q_in, f, n);
+            n = sched_take(dev, XCAN_LOOP_DIR_IN, f, n);
         }
+
+        n = xcan_dequeue_bulk(dev->q_in, f, n);
+        if(n == 0)
+            break;
+
+        xcan_datalink_receive_bulk(f, n);
+        loop_score -= n;
     }
 
     return loop_score;
 }
 
-static int devloop_out(struct xcan_device *dev, int loop_score)
+static uint32_t devloop_send(struct xcan_device *dev, struct xcan_frame **f, uint32_t n)
+{
+    uint32_t sent = 0;
+
+    if(dev->send_bulk)
+        return dev->send_bulk(dev, f, n);
+
+    while(sent < n) {
+        if(dev->send(dev, f[sent]->id, f[sent]->flags, f[sent]->data, f[sent]->len) != 0)
+            break;
+        sent++;
+    }
+
+    return sent;
+}
+
+/* ------- Retries ------- */
+
+#define RETRY_HELD      1   /* Parked behind a frame of its ID, not tried yet */
+#define RETRY_FAILED    2   /* Parked after failing to send */
+
+/* Single writer, read from other threads */
+static inline uint32_t retry_count(struct xcan_device_retry *r)
+{
+    return atomic_load_explicit(&r->count, memory_order_relaxed);
+}
+
+static inline void retry_add(_Atomic uint64_t *c)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+static inline uint64_t retry_backoff(uint8_t failed)
+{
+    return (XCAN_RETRY_BACKOFF_US * 1000ULL) << (failed - 1);
+}
+
+/* Whether a frame with id must wait for a parked frame, or for one of the
+   first n frames of f that are about to be parked */
+static bool retry_holds(struct xcan_device_retry *r, uint32_t id,
+                        struct xcan_frame **f, uint8_t *park, uint32_t n)
+{
+    uint32_t count = retry_count(r);
+
+    for(uint32_t i = 0 ; i < count ; i++) {
+        if(r->frame[i]->id == id)
+            return true;
+    }
+
+    for(uint32_t i = 0 ; i < n ; i++) {
+        if(park[i] && f[i]->id == id)
+            return true;
+    }
+
+    return false;
+}
+
+static void retry_park(struct xcan_device_retry *r, struct xcan_frame *f, uint8_t how, uint64_t now)
 {
+    uint32_t i = retry_count(r);
+
+    r->frame[i] = f;
+    r->failed[i] = (how == RETRY_FAILED) ? 1 : 0;
+    r->deadline[i] = (how == RETRY_FAILED) ? now + retry_backoff(1) : 0;
+    atomic_store_explicit(&r->count, i + 1, memory_order_relaxed);
+}
+
+static void retry_remove(struct xcan_device_retry *r, uint32_t i)
+{
+    uint32_t count = retry_count(r) - 1;
+
+    memmove(&r->frame[i], &r->frame[i + 1], (count - i) * sizeof(r->frame[0]));
+    memmove(&r->deadline[i], &r->deadline[i + 1], (count - i) * sizeof(r->deadline[0]));
+    memmove(&r->failed[i], &r->failed[i + 1], (count - i) * sizeof(r->failed[0]));
+    atomic_store_explicit(&r->count, count, memory_order_relaxed);
+}
+
+/* Tries the parked frames that are due, up to loop_score of them and with
+   sched set as far as the device's deficit pays. Returns the number of
+   frames sent or dropped. */
+static int devloop_retry(struct xcan_device *dev, uint64_t now, int loop_score, bool sched)
+{
+    struct xcan_device_retry *r = &dev->retry;
     struct xcan_frame *f;
+    uint32_t i = 0, j;
+    int done = 0;
+
+    while(i < retry_count(r) && done < loop_score)
+    {
+        f = r->frame[i];
+
+        /* An earlier frame of the same ID goes first */
+        for(j = 0 ; j < i && r->frame[j]->id != f->id ; j++);
+
+        if(j < i || r->deadline[i] > now) {
+            i++;
+            continue;
+        }
+
+        if(sched && sched_take(dev, XCAN_LOOP_DIR_OUT, &f, 1) == 0)
+            break;
+
+        if(r->failed[i])
+            retry_add(&r->retries);
+
+        if(devloop_send(dev, &f, 1) == 1) {
+            xcan_latency_sent(dev, &f, 1, now);
+            xcan_stats_sent(dev, &f, 1);
+            xcan_frame_discard(f);
+            retry_remove(r, i);
+            done++;
+            continue;
+        }
+
+        xcan_stats_inc(dev->id, tx, failed, 1);
+
+        if(++r->failed[i] > XCAN_RETRY_LIMIT) {
+            xcan_trace(XCAN_TRACE_RETRY_DROP, dev->id, f->id, r->failed[i]);
+            xcan_stats_inc(dev->id, tx, dropped, 1);
+            retry_add(&r->dropped);
+            xcan_frame_discard(f);
+        } else {
+            /* Still parked, so it did not use up its share */
+            if(sched)
+                sched_refund(dev, XCAN_LOOP_DIR_OUT, &f, 1);
+
+            r->deadline[i] = now + retry_backoff(r->failed[i]);
+            i++;
+            continue;
+        }
+
+        retry_remove(r, i);
+        done++;
+    }
+
+    return done;
+}
+
+/* Sends what it can of n frames from the head of the output queue and
+   marks in park those to be parked. Returns the number of frames dealt
+   with, which stops short of n once no more frames can be parked. */
+static uint32_t devloop_drain(struct xcan_device *dev, struct xcan_frame **f, uint8_t *park, uint32_t n)
+{
+    struct xcan_device_retry *r = &dev->retry;
+    uint32_t count = retry_count(r);
+    uint32_t done = 0, parked = 0, run, sent;
+
+    while(done < n)
+    {
+        /* Frames not held back by a parked frame of their ID */
+        run = 0;
+        while(done + run < n &&
+              !((count || parked) && retry_holds(r, f[done + run]->id, f, park, done + run))) {
+            park[done + run] = 0;
+            run++;
+        }
+
+        if(run > 0) {
+            sent = devloop_send(dev, f + done, run);
+            done += sent;
+
+            if(sent == run)
+                continue;
+        }
+
+        /* Failed to send, or held back */
+        if(count + parked == XCAN_RETRY_FRAMES)
+            break;
+
+        park[done++] = (run > 0) ? RETRY_FAILED : RETRY_HELD;
+        parked++;
+    }
+
+    return done;
+}
+
+/* With sched set the device's deficit limits what it may send */
+static int devloop_out(struct xcan_device *dev, int loop_score, bool sched)
+{
+    struct xcan_frame *f[XCAN_BURST];
+    uint8_t park[XCAN_BURST];
+    uint32_t n, done, sent;
+    uint64_t now;
 
     if(!dev)
         return loop_score;
 
+    now = xcan_time_ns();
+
+    if(retry_count(&dev->retry))
+        loop_score -= devloop_retry(dev, now, loop_score, sched);
+
     while(loop_score > 0)
     {
-        if(dev->q_out->frames == 0)
+        /* We just peek incase device is unable to send frames,
+           then we retain them */
+        n = xcan_queue_peek_bulk(dev->q_out, f, (loop_score < XCAN_BURST) ? loop_score : XCAN_BURST);
+        if(sched)
+            n = sched_take(dev, XCAN_LOOP_DIR_OUT, f, n);
+        if(n == 0)
             break;
 
-        /* We just peek incase device is unable to send frame,
-           then we retain it */
-        f = xcan_queue_peek(dev->q_out);
-        if(!f)
-            break;
+        done = devloop_drain(dev, f, park, n);
+        now = xcan_time_ns();
 
-        if(dev->send(dev, f->id, f->flags, f->data, f->len) == 0) {
-            /* Frame successfully sent */
-            f = xcan_dequeue(dev->q_out);
-            xcan_frame_discard(f);
-            loop_score--;
-        } else {
-            /* Failed to send frame, try again next time round */
+        if(sched)
+            sched_refund(dev, XCAN_LOOP_DIR_OUT, f + done, n - done);
+
+        /* Take the frames dealt with off the queue, then park those that
+           failed and drop those that were sent */
+        xcan_dequeue_bulk(dev->q_out, f, done);
+        for(uint32_t i = sent = 0 ; i < done ; i++) {
+            if(park[i]) {
+                xcan_trace(XCAN_TRACE_RETRY_PARK, dev->id, f[i]->id, park[i] == RETRY_FAILED);
+                if(park[i] == RETRY_FAILED)
+                    xcan_stats_inc(dev->id, tx, failed, 1);
+                retry_park(&dev->retry, f[i], park[i], now);
+            }
+            else
+                f[sent++] = f[i];
+        }
+
+        if(sent > 0) {
+            xcan_latency_sent(dev, f, sent, now);
+            xcan_stats_sent(dev, f, sent);
+        }
+        for(uint32_t i = 0 ; i < sent ; i++)
+            xcan_frame_discard(f[i]);
+
+        loop_score -= done;
+
+        if(done < n) {
+            /* Nowhere left to park, try again next time round */
             break;
         }
     }
@@ -58,13 +362,124 @@ static int devloop_out(struct xcan_device *dev, int loop_score)
 }
 
 
+/* ------- Registry ------- */
+
+static inline struct device_table* table_get(void)
+{
+    return atomic_load_explicit(&m_table, memory_order_acquire);
+}
+
+static void table_free(void *ptr)
+{
+    if(ptr != &m_empty)
+        XCAN_FREE(ptr);
+}
+
+/* Publishes a table with add registered and remove not. Called with the
+   registry lock held. */
+static int table_replace(struct xcan_device *add, struct xcan_device *remove)
+{
+    struct device_table *old = table_get(), *t;
+    uint32_t no_ids = 0, no_active = 0;
+    struct xcan_device *dev;
+
+    for(uint32_t i = 0 ; i < old->no_active ; i++) {
+        if(old->active[i] != remove && old->active[i]->id + 1U > no_ids)
+            no_ids = old->active[i]->id + 1;
+    }
+
+    if(add && add->id + 1U > no_ids)
+        no_ids = add->id + 1;
+
+    t = XCAN_ZALLOC(sizeof(struct device_table) +
+                    (old->no_active + 1 + no_ids) * sizeof(struct xcan_device *));
+    if(!t)
+        return -1;
+
+    t->no_ids = no_ids;
+    t->by_id = &t->active[old->no_active + 1];
+
+    for(uint32_t i = 0 ; i <= old->no_active ; i++) {
+        dev = (i < old->no_active) ? old->active[i] : add;
+        if(!dev || dev == remove)
+            continue;
+
+        t->active[no_active++] = dev;
+        t->by_id[dev->id] = dev;
+    }
+
+    t->no_active = no_active;
+    atomic_store_explicit(&m_table, t, memory_order_release);
+
+    if(xcan_rcu_retire(old, table_free) != 0) {
+        /* Leak it rather than risk freeing it under a reader */
+        dbg("XCAN Device: Failed to retire device table\n");
+    }
+
+    return 0;
+}
+
+static int registry_add(struct xcan_device *dev)
+{
+    int ret = -1;
+
+    while(atomic_flag_test_and_set_explicit(&m_registry_lock, memory_order_acquire));
+
+    if(!xcan_get_device(dev->id))
+        ret = table_replace(dev, NULL);
+
+    atomic_flag_clear_explicit(&m_registry_lock, memory_order_release);
+    return ret;
+}
+
+static int registry_remove(struct xcan_device *dev)
+{
+    int ret = -1;
+
+    while(atomic_flag_test_and_set_explicit(&m_registry_lock, memory_order_acquire));
+
+    if(xcan_get_device(dev->id) == dev)
+        ret = table_replace(NULL, dev);
+
+    atomic_flag_clear_explicit(&m_registry_lock, memory_order_release);
+    return ret;
+}
+
+static void device_queues_free(struct xcan_device *dev)
+{
+    xcan_queue_destroy(dev->q_in);
+    xcan_queue_destroy(dev->q_out);
+    XCAN_FREE(dev->q_in);
+    XCAN_FREE(dev->q_out);
+}
+
+/* Runs once the forwarding loop can no longer be using dev */
+static void device_free(void *ptr)
+{
+    struct xcan_device *dev = ptr;
+
+    device_queues_free(dev);
+
+    for(uint32_t i = retry_count(&dev->retry) ; i > 0 ; i--)
+        xcan_frame_discard(dev->retry.frame[i - 1]);
+    atomic_store_explicit(&dev->retry.count, 0, memory_order_relaxed);
+
+    /* Call device specific destroyer */
+    dev->destroy(dev);
+}
+
+
 int xcan_device_init(struct xcan_device *dev, uint8_t id, const char *name)
 {
     if(id >= XCAN_MAX_DEVICES)
         return -1;
 
     dev->id = id;
-    strncpy(dev->name, name, XCAN_MAX_DEVICE_NAME);
+    strncpy(dev->name, name, XCAN_MAX_DEVICE_NAME - 1);
+    dev->name[XCAN_MAX_DEVICE_NAME - 1] = '\0';
+
+    for(int dir = XCAN_LOOP_DIR_IN ; dir <= XCAN_LOOP_DIR_OUT ; dir++)
+        xcan_device_set_weight(dev, dir, XCAN_SCHED_FRAMES, XCAN_SCHED_QUANTUM);
 
     dev->q_in = XCAN_ZALLOC(sizeof(struct xcan_queue));
     if(!dev->q_in)
@@ -76,8 +491,34 @@ int xcan_device_init(struct xcan_device *dev, uint8_t id, const char *name)
         return -1;
     }
 
+    if(xcan_queue_init(dev->q_in, XCAN_DEVICE_QUEUE, XCAN_DEVICE_QUEUE_FRAMES) != 0 ||
+       xcan_queue_init(dev->q_out, XCAN_DEVICE_QUEUE, XCAN_DEVICE_QUEUE_FRAMES) != 0 ||
+       xcan_latency_attach(dev) != 0) {
+        device_queues_free(dev);
+        return -1;
+    }
+
+    dev->q_routed = dev->q_out;
+
+    if(xcan_event_add(dev) != 0) {
+        device_queues_free(dev);
+        return -1;
+    }
+
     /* Register device with device pool */
-    devices[id] = dev;
+    if(registry_add(dev) != 0) {
+        dbg("XCAN Device (%s): ID %u already in use\n", dev->name, id);
+        xcan_event_del(dev);
+        device_queues_free(dev);
+        return -1;
+    }
+
+    xcan_stats_attach(dev);
+
+    /* Once registered, route updates refilter the device too */
+    if(xcan_router_filter_device(dev) != 0)
+        dbg("XCAN Device (%s): Failed to set receive filters\n", dev->name);
+
     return 0;
 }
 
@@ -85,49 +526,206 @@ int xcan_device_init(struct xcan_device *dev, uint8_t id, const char *name)
 void xcan_device_destroy(struct xcan_device *dev)
 {
     /* Unregister device with device pool */
-    devices[dev->id] = NULL;
+    xcan_event_del(dev);
 
-    /* Call device specific destroyer */
-    dev->destroy(dev);
+    if(registry_remove(dev) != 0) {
+        device_free(dev);
+        return;
+    }
+
+    xcan_stats_detach(dev);
+
+    /* Free once the forwarding loop has let go of it */
+    if(xcan_rcu_retire(dev, device_free) != 0) {
+        dbg("XCAN Device (%s): Failed to retire device\n", dev->name);
+        return;
+    }
+
+    xcan_rcu_reclaim();
 }
 
 
+/* Replace one of the device queues, e.g. with a ring so that another thread
+   can feed it. Frames still queued are discarded. */
+int xcan_device_set_queue(struct xcan_device *dev, int direction,
+                          enum xcan_queue_type type, uint32_t max_frames)
+{
+    struct xcan_queue q;
+    struct xcan_queue *target;
 
-int xcan_devices_loop(int loop_score, int direction)
+    if(direction == XCAN_LOOP_DIR_IN)
+        target = dev->q_in;
+    else if(direction == XCAN_LOOP_DIR_OUT)
+        target = dev->q_out;
+    else
+        return -1;
+
+    if(xcan_queue_init(&q, type, max_frames) != 0)
+        return -1;
+
+    xcan_queue_destroy(target);
+    memcpy(target, &q, sizeof(struct xcan_queue));
+    return 0;
+}
+
+int xcan_device_set_coalesce(struct xcan_device *dev, int direction, bool coalesce)
+{
+    if(direction == XCAN_LOOP_DIR_IN)
+        return xcan_queue_set_coalesce(dev->q_in, coalesce);
+
+    if(direction == XCAN_LOOP_DIR_OUT)
+        return xcan_queue_set_coalesce(dev->q_out, coalesce);
+
+    return -1;
+}
+
+int xcan_device_set_weight(struct xcan_device *dev, int direction,
+                           enum xcan_sched_unit unit, uint32_t quantum)
+{
+    if((direction != XCAN_LOOP_DIR_IN && direction != XCAN_LOOP_DIR_OUT) ||
+       (unit != XCAN_SCHED_FRAMES && unit != XCAN_SCHED_BITS) || quantum == 0)
+        return -1;
+
+    dev->sched.unit[direction] = unit;
+    dev->sched.quantum[direction] = quantum;
+    dev->sched.deficit[direction] = 0;
+    return 0;
+}
+
+/* Deficit round robin. Every pass over the devices credits each with its
+   quantum, and a device moves frames until the next one would cost more
+   than its credit. A device left with nothing to do loses its credit, so
+   no device saves up for a burst. */
+int xcan_devices_serve(struct xcan_device *const *devs, uint32_t n, int loop_score, int direction)
 {
-    /** @todo */
+    struct xcan_device_sched *s;
+    struct xcan_device *dev;
+    uint32_t start, k = 0;
+    int pass;
+
+    if(n == 0 || (direction != XCAN_LOOP_DIR_IN && direction != XCAN_LOOP_DIR_OUT))
+        return loop_score;
+
+    start = m_cursor[direction] % n;
 
     while(loop_score > 0)
     {
-        if(direction == 0)
-        {
-            /* Receiving frames into the stack */
-            for(int i = 0 ; i < XCAN_MAX_DEVICES ; i++) {
-                loop_score = devloop_in(devices[i], loop_score);
-            }
-        }
-        else if(direction == 1)
-        {
-            /* Sending frames out of the stack */
-            for(int i = 0 ; i < XCAN_MAX_DEVICES ; i++) {
-                loop_score = devloop_out(devices[i], loop_score);
-            }
+        pass = loop_score;
+
+        for(k = 0 ; k < n && loop_score > 0 ; k++) {
+            dev = devs[(start + k) % n];
+            s = &dev->sched;
+
+            s->deficit[direction] += s->quantum[direction];
+
+            if(direction == XCAN_LOOP_DIR_IN)
+                loop_score = devloop_in(dev, loop_score, true);
+            else
+                loop_score = devloop_out(dev, loop_score, true);
+
+            if(!sched_backlog(dev, direction))
+                s->deficit[direction] = 0;
         }
 
-        loop_score--;
+        /* No device had any work left, or credit for it */
+        if(loop_score == pass)
+            break;
     }
 
+    /* Carry on after the last device served */
+    m_cursor[direction] = (start + k) % n;
+    return loop_score;
+}
+
+int xcan_devices_loop(int loop_score, int direction)
+{
+    struct device_table *t = table_get();
+
+    return xcan_devices_serve(t->active, t->no_active, loop_score, direction);
+}
+
+int xcan_device_loop(struct xcan_device *dev, int loop_score, int direction)
+{
+    if(direction == XCAN_LOOP_DIR_IN)
+        return devloop_in(dev, loop_score, false);
+
+    if(direction == XCAN_LOOP_DIR_OUT)
+        return devloop_out(dev, loop_score, false);
+
     return loop_score;
 }
 
 struct xcan_device* xcan_get_device(uint8_t id)
 {
-    for(int i = 0 ; i < XCAN_MAX_DEVICES ; i++) {
-        if(devices[i]->id == id) {
-            return devices[i];
-        }        
+    struct device_table *t = table_get();
+
+    return (id < t->no_ids) ? t->by_id[id] : NULL;
+}
+
+struct xcan_device* const* xcan_device_list(uint32_t *n)
+{
+    struct device_table *t = table_get();
+
+    *n = t->no_active;
+    return t->active;
+}
+
+int xcan_devices_foreach(int (*fn)(struct xcan_device *dev, void *arg), void *arg)
+{
+    struct device_table *t;
+    int ret = 0;
+
+    /* Devices cannot be removed, and so freed, while the lock is held */
+    while(atomic_flag_test_and_set_explicit(&m_registry_lock, memory_order_acquire));
+
+    t = table_get();
+    for(uint32_t i = 0 ; i < t->no_active ; i++) {
+        if(fn(t->active[i], arg) != 0)
+            ret = -1;
+    }
+
+    atomic_flag_clear_explicit(&m_registry_lock, memory_order_release);
+    return ret;
+}
+
+int xcan_device_retry_stats(struct xcan_device *dev, struct xcan_retry_stats *stats)
+{
+    if(!dev || !stats)
+        return -1;
+
+    stats->parked = xcan_device_parked(dev);
+    stats->retries = atomic_load_explicit(&dev->retry.retries, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&dev->retry.dropped, memory_order_relaxed);
+    return 0;
+}
+
+uint64_t xcan_device_retry_deadline(struct xcan_device *dev)
+{
+    struct xcan_device_retry *r = &dev->retry;
+    uint32_t count = retry_count(r);
+    uint64_t deadline = 0;
+
+    /* Frames held behind another are sent right after it */
+    for(uint32_t i = 0 ; i < count ; i++) {
+        if(r->failed[i] && (!deadline || r->deadline[i] < deadline))
+            deadline = r->deadline[i];
+    }
+
+    return deadline;
+}
+
+uint64_t xcan_devices_retry_deadline(void)
+{
+    struct device_table *t = table_get();
+    uint64_t deadline = 0, d;
+
+    for(uint32_t n = 0 ; n < t->no_active ; n++) {
+        d = xcan_device_retry_deadline(t->active[n]);
+        if(d && (!deadline || d < deadline))
+            deadline = d;
     }
-    return NULL;
+
+    return deadline;
 }
 
 int xcan_device_link_state(struct xcan_device *dev)
@@ -0,0 +1,88 @@
+#include "xcan_event.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+static int m_epfd = -1;
+
+
+static int event_fd(void)
+{
+    if(m_epfd < 0)
+        m_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    return m_epfd;
+}
+
+/* Events carry the device ID rather than a pointer, as the device may be
+   gone by the time an event is handled */
+int xcan_event_add(struct xcan_device *dev)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = dev->id };
+    int fd;
+
+    if(!dev->get_fd || (fd = dev->get_fd(dev)) < 0)
+        return 0;
+
+    if(event_fd() < 0)
+        return -1;
+
+    if(epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        dbg("XCAN Event (%s): Failed to watch device\n", dev->name);
+        return -1;
+    }
+
+    dev->events = EPOLLIN;
+    return 0;
+}
+
+void xcan_event_del(struct xcan_device *dev)
+{
+    if(!dev->events)
+        return;
+
+    epoll_ctl(m_epfd, EPOLL_CTL_DEL, dev->get_fd(dev), NULL);
+    dev->events = 0;
+}
+
+int xcan_event_want_out(struct xcan_device *dev, bool want)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = dev->id };
+
+    if(want)
+        ev.events |= EPOLLOUT;
+
+    if(!dev->events || dev->events == ev.events)
+        return 0;
+
+    if(epoll_ctl(m_epfd, EPOLL_CTL_MOD, dev->get_fd(dev), &ev) != 0)
+        return -1;
+
+    dev->events = ev.events;
+    return 0;
+}
+
+int xcan_event_wait(uint8_t *ready, int max, int timeout_ms)
+{
+    struct epoll_event ev[XCAN_MAX_DEVICES];
+    int n, found = 0;
+
+    if(event_fd() < 0)
+        return -1;
+
+    if(max > XCAN_MAX_DEVICES)
+        max = XCAN_MAX_DEVICES;
+
+    n = epoll_wait(m_epfd, ev, max, timeout_ms);
+    if(n < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    for(int i = 0 ; i < n ; i++) {
+        /* Output readiness alone only needs the TX pass */
+        if(ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            ready[found++] = ev[i].data.u32;
+    }
+
+    return found;
+}
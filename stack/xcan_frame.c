@@ -1,34 +1,105 @@
 #include "xcan_frame.h"
 
+/* A classic CAN frame must stay within one cache line */
+_Static_assert(offsetof(struct xcan_frame, payload) + XCAN_PAYLOAD_CAN <= XCAN_CACHE_LINE,
+               "xcan_frame header too large");
+
+/* Pools must hold what the device queues can (see xcan_config.h), or frames
+   are lost to an empty pool before any queue counts them as dropped.
+   Unbounded queues cannot be covered. */
+#if XCAN_DEVICE_QUEUE_FRAMES
+_Static_assert(XCAN_POOL_CAN_FRAMES >= XCAN_POOL_DEVICES * XCAN_DEVICE_FRAMES &&
+               XCAN_POOL_CANFD_FRAMES >= XCAN_POOL_DEVICES * XCAN_DEVICE_FRAMES,
+               "Frame pools smaller than XCAN_POOL_DEVICES devices' queues");
+_Static_assert(XCAN_POOL_DESCRIPTORS >= XCAN_POOL_DEVICES * XCAN_DEVICE_COPIES,
+               "Descriptor pool smaller than XCAN_POOL_DEVICES devices' send queues");
+#endif
+
+/* Frame blocks hold the header followed by the payload, padded to whole
+   cache lines so every frame starts on a cache line boundary */
+#define FRAME_BLOCK(size) \
+    ((offsetof(struct xcan_frame, payload) + (size) + XCAN_CACHE_LINE - 1) & ~(XCAN_CACHE_LINE - 1))
+
+static uint8_t m_desc_mem[XCAN_POOL_DESCRIPTORS][FRAME_BLOCK(0)] XCAN_CACHE_ALIGNED;
+static uint8_t m_can_mem[XCAN_POOL_CAN_FRAMES][FRAME_BLOCK(XCAN_PAYLOAD_CAN)] XCAN_CACHE_ALIGNED;
+static uint8_t m_canfd_mem[XCAN_POOL_CANFD_FRAMES][FRAME_BLOCK(XCAN_PAYLOAD_CANFD)] XCAN_CACHE_ALIGNED;
+static uint8_t m_xl_mem[XCAN_POOL_XL_FRAMES][FRAME_BLOCK(XCAN_PAYLOAD_XL)] XCAN_CACHE_ALIGNED;
+
+static struct xcan_pool m_pools[XCAN_FRAME_POOLS] = {
+    [XCAN_FRAME_POOL_DESC]  = XCAN_POOL_INITIALIZER(m_desc_mem, FRAME_BLOCK(0), XCAN_POOL_DESCRIPTORS),
+    [XCAN_FRAME_POOL_CAN]   = XCAN_POOL_INITIALIZER(m_can_mem, FRAME_BLOCK(XCAN_PAYLOAD_CAN), XCAN_POOL_CAN_FRAMES),
+    [XCAN_FRAME_POOL_CANFD] = XCAN_POOL_INITIALIZER(m_canfd_mem, FRAME_BLOCK(XCAN_PAYLOAD_CANFD), XCAN_POOL_CANFD_FRAMES),
+    [XCAN_FRAME_POOL_XL]    = XCAN_POOL_INITIALIZER(m_xl_mem, FRAME_BLOCK(XCAN_PAYLOAD_XL), XCAN_POOL_XL_FRAMES),
+};
+
+static const uint32_t m_payload[XCAN_FRAME_POOLS] = {
+    [XCAN_FRAME_POOL_DESC]  = 0,
+    [XCAN_FRAME_POOL_CAN]   = XCAN_PAYLOAD_CAN,
+    [XCAN_FRAME_POOL_CANFD] = XCAN_PAYLOAD_CANFD,
+    [XCAN_FRAME_POOL_XL]    = XCAN_PAYLOAD_XL,
+};
+
+static int frame_pool(uint32_t size)
+{
+    if(size <= XCAN_PAYLOAD_CAN)
+        return XCAN_FRAME_POOL_CAN;
+    if(size <= XCAN_PAYLOAD_CANFD)
+        return XCAN_FRAME_POOL_CANFD;
+    if(size <= XCAN_PAYLOAD_XL)
+        return XCAN_FRAME_POOL_XL;
+    return -1;
+}
+
 static struct xcan_frame* xcan_frame_do_alloc(uint32_t size)
 {
-    struct xcan_frame *f = XCAN_ZALLOC(sizeof(struct xcan_frame));
+    struct xcan_frame *f;
+    int pool = frame_pool(size);
 
-    if(!f)
+    if(pool < 0)
         return NULL;
 
-    /* Allocate space for frame payload and usage counter */
-    f->data = XCAN_ZALLOC(size + sizeof(uint8_t));
-    if(!f->data)
-        XCAN_FREE(f);
+    f = xcan_pool_get(&m_pools[pool]);
+    if(!f)
+        return NULL;
 
+    f->next = NULL;
+    f->dev = NULL;
+    f->data = f->payload;
+    f->owner = f;
+    f->id = 0;
     f->len = size;
     f->flags = 0;
-    f->usage_count = (f->data + size);
+    f->pool = pool;
+    f->route = XCAN_ROUTE_NONE;
+    f->opts = 0;
+    f->ts = 0;
+    atomic_init(&f->refcnt, 1);
     return f;
 }
 
+static void frame_release(struct xcan_frame *owner)
+{
+    /* A sole reference cannot be copied concurrently, so it is released
+       without a read-modify-write */
+    if(atomic_load_explicit(&owner->refcnt, memory_order_acquire) == 1 ||
+       atomic_fetch_sub_explicit(&owner->refcnt, 1, memory_order_acq_rel) == 1)
+        xcan_pool_put(&m_pools[owner->pool], owner);
+}
+
 void xcan_frame_discard(struct xcan_frame *f)
 {
+    struct xcan_frame *owner;
+
     if(!f)
         return;
 
-    *(f->usage_count) += -1;
+    owner = f->owner;
 
-    if(*f->usage_count == 0) {
-        XCAN_FREE(f->data);
-        XCAN_FREE(f);
-    }
+    /* Copies only own their header */
+    if(f != owner)
+        xcan_pool_put(&m_pools[XCAN_FRAME_POOL_DESC], f);
+
+    frame_release(owner);
 }
 
 struct xcan_frame* xcan_frame_alloc(uint32_t size)
@@ -39,28 +110,79 @@ struct xcan_frame* xcan_frame_alloc(uint32_t size)
 /* Only copies frame descriptor, not frame payload. */
 struct xcan_frame* xcan_frame_copy(struct xcan_frame *f)
 {
-    struct xcan_frame *new = XCAN_ZALLOC(sizeof(struct xcan_frame));
+    struct xcan_frame *new = xcan_pool_get(&m_pools[XCAN_FRAME_POOL_DESC]);
 
     if(!new)
         return NULL;
 
     memcpy(new, f, sizeof(struct xcan_frame));
-    *(new->usage_count) += 1;
     new->next = NULL;
+    new->pool = XCAN_FRAME_POOL_DESC;
+    atomic_init(&new->refcnt, 0);
+    atomic_fetch_add_explicit(&new->owner->refcnt, 1, memory_order_relaxed);
     return new;
 }
 
 struct xcan_frame* xcan_frame_deepcopy(struct xcan_frame *f)
 {
-    struct xcan_frame *new = xcan_frame_copy(f);
+    struct xcan_frame *new;
 
     if(!f)
         return NULL;
 
-    new->data = XCAN_ZALLOC(new->len + sizeof(uint8_t));
-    memcpy(new->data, f->data, new->len);
+    new = xcan_frame_do_alloc(f->len);
+    if(!new)
+        return NULL;
 
-    new->usage_count = new->data + new->len;
-    *(new->usage_count) = 1;
+    new->dev = f->dev;
+    new->id = f->id;
+    new->flags = f->flags;
+    new->ts = f->owner->ts;
+    memcpy(new->data, f->data, new->len);
     return new;
 }
+
+int xcan_frame_replace(struct xcan_frame *dst, struct xcan_frame *src)
+{
+    struct xcan_frame *owner = dst->owner;
+
+    /* The payload of dst can only be overwritten if nothing else is
+       looking at it */
+    if(dst == owner && (atomic_load_explicit(&dst->refcnt, memory_order_acquire) != 1 ||
+                        src->len > m_payload[dst->pool]))
+        return -1;
+
+    dst->dev = src->dev;
+    dst->id = src->id;
+    dst->len = src->len;
+    dst->flags = src->flags;
+    dst->route = src->route;
+
+    if(dst == owner) {
+        memcpy(dst->payload, src->data, src->len);
+        dst->ts = src->owner->ts;
+        xcan_frame_discard(src);
+        return 0;
+    }
+
+    /* A copy takes over the reference src holds to its payload and drops
+       the one to its old payload */
+    dst->data = src->data;
+    dst->owner = src->owner;
+    dst->ts = src->ts;
+
+    if(src != src->owner)
+        xcan_pool_put(&m_pools[XCAN_FRAME_POOL_DESC], src);
+
+    frame_release(owner);
+    return 0;
+}
+
+int xcan_frame_pool_stats(enum xcan_frame_pool pool, struct xcan_pool_stats *stats)
+{
+    if(pool >= XCAN_FRAME_POOLS)
+        return -1;
+
+    xcan_pool_stats(&m_pools[pool], stats);
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "xcan_latency.h"
+
+#define SUB_BUCKETS     (1U << XCAN_HIST_SUB_BITS)
+#define HALF_BUCKETS    (SUB_BUCKETS / 2)
+
+/* Histogram as written on the forwarding path. Only one thread writes a
+   histogram, so updates are relaxed loads and stores rather than
+   read-modify-writes; the atomics only keep concurrent readers defined. */
+struct hist {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint32_t bucket[XCAN_HIST_BUCKETS];
+};
+
+struct dev_latency {
+    struct hist stage[XCAN_LATENCY_STAGES];
+    struct hist route[XCAN_LATENCY_ROUTES];
+};
+
+/* Allocated when a device id is first used and kept, so readers never see
+   it freed */
+static struct dev_latency *_Atomic m_dev[XCAN_MAX_DEVICES];
+
+
+static inline uint32_t hist_index(uint64_t ns)
+{
+    uint32_t msb, shift;
+
+    if(ns < SUB_BUCKETS)
+        return ns;
+
+    if(ns >> XCAN_HIST_MAX_BITS)
+        return XCAN_HIST_BUCKETS - 1;
+
+    msb = 63 - __builtin_clzll(ns);
+    shift = msb - XCAN_HIST_SUB_BITS + 1;
+    return shift * HALF_BUCKETS + (uint32_t)(ns >> shift);
+}
+
+/* Largest value counted in bucket i */
+static uint64_t hist_value(uint32_t i)
+{
+    uint32_t shift;
+
+    if(i < SUB_BUCKETS)
+        return i;
+
+    shift = i / HALF_BUCKETS - 1;
+    return (((uint64_t)(i - shift * HALF_BUCKETS) + 1) << shift) - 1;
+}
+
+#define RELAXED_ADD(var, n) \
+    atomic_store_explicit(&(var), atomic_load_explicit(&(var), memory_order_relaxed) + (n), memory_order_relaxed)
+
+static inline void hist_record(struct hist *h, uint64_t ns)
+{
+    RELAXED_ADD(h->bucket[hist_index(ns)], 1);
+    RELAXED_ADD(h->count, 1);
+    RELAXED_ADD(h->sum, ns);
+
+    if(ns > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+}
+
+static void hist_clear(struct hist *h)
+{
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+
+    for(uint32_t i = 0 ; i < XCAN_HIST_BUCKETS ; i++)
+        atomic_store_explicit(&h->bucket[i], 0, memory_order_relaxed);
+}
+
+/* Adds h to out */
+static void hist_read(struct hist *h, struct xcan_hist *out)
+{
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+    out->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    if(max > out->max)
+        out->max = max;
+
+    for(uint32_t i = 0 ; i < XCAN_HIST_BUCKETS ; i++)
+        out->bucket[i] += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+}
+
+static inline struct dev_latency* dev_latency(struct xcan_device *dev)
+{
+    return dev ? atomic_load_explicit(&m_dev[dev->id], memory_order_relaxed) : NULL;
+}
+
+
+uint64_t xcan_hist_percentile(const struct xcan_hist *h, double percentile)
+{
+    uint64_t total = 0, rank, seen = 0;
+
+    for(uint32_t i = 0 ; i < XCAN_HIST_BUCKETS ; i++)
+        total += h->bucket[i];
+
+    if(total == 0)
+        return 0;
+
+    if(percentile <= 0)
+        rank = 1;
+    else if(percentile >= 100)
+        rank = total;
+    else
+        rank = (uint64_t)(percentile / 100 * total + 0.999999);
+
+    for(uint32_t i = 0 ; i < XCAN_HIST_BUCKETS ; i++) {
+        seen += h->bucket[i];
+        if(seen >= rank)
+            return (hist_value(i) < h->max) ? hist_value(i) : h->max;
+    }
+
+    return h->max;
+}
+
+uint64_t xcan_hist_mean(const struct xcan_hist *h)
+{
+    return h->count ? h->sum / h->count : 0;
+}
+
+int xcan_latency_device(uint8_t dev_id, enum xcan_latency_stage stage, struct xcan_hist *out)
+{
+    struct dev_latency *lat;
+
+    if(dev_id >= XCAN_MAX_DEVICES || stage >= XCAN_LATENCY_STAGES || !out)
+        return -1;
+
+    memset(out, 0, sizeof(*out));
+
+    lat = atomic_load_explicit(&m_dev[dev_id], memory_order_acquire);
+    if(!lat)
+        return -1;
+
+    hist_read(&lat->stage[stage], out);
+    return 0;
+}
+
+int xcan_latency_route(uint32_t entry, struct xcan_hist *out)
+{
+    struct dev_latency *lat;
+
+    if(entry >= XCAN_LATENCY_ROUTES || !out)
+        return -1;
+
+    memset(out, 0, sizeof(*out));
+
+    for(int id = 0 ; id < XCAN_MAX_DEVICES ; id++) {
+        lat = atomic_load_explicit(&m_dev[id], memory_order_acquire);
+        if(lat)
+            hist_read(&lat->route[entry], out);
+    }
+
+    return 0;
+}
+
+void xcan_latency_reset(void)
+{
+    struct dev_latency *lat;
+
+    for(int id = 0 ; id < XCAN_MAX_DEVICES ; id++) {
+        lat = atomic_load_explicit(&m_dev[id], memory_order_acquire);
+        if(!lat)
+            continue;
+
+        for(int s = 0 ; s < XCAN_LATENCY_STAGES ; s++)
+            hist_clear(&lat->stage[s]);
+        for(int r = 0 ; r < XCAN_LATENCY_ROUTES ; r++)
+            hist_clear(&lat->route[r]);
+    }
+}
+
+#if XCAN_LATENCY
+
+int xcan_latency_attach(struct xcan_device *dev)
+{
+    struct dev_latency *lat = atomic_load_explicit(&m_dev[dev->id], memory_order_acquire);
+
+    if(lat)
+        return 0;
+
+    lat = XCAN_ZALLOC(sizeof(struct dev_latency));
+    if(!lat)
+        return -1;
+
+    atomic_store_explicit(&m_dev[dev->id], lat, memory_order_release);
+    return 0;
+}
+
+void xcan_latency_routed(struct xcan_frame *f, uint64_t now)
+{
+    struct dev_latency *lat = dev_latency(f->dev);
+
+    if(lat && f->ts && now >= f->ts)
+        hist_record(&lat->stage[XCAN_LATENCY_RX], now - f->ts);
+}
+
+void xcan_latency_sent(struct xcan_device *dev, struct xcan_frame **f, uint32_t n, uint64_t now)
+{
+    struct dev_latency *lat = dev_latency(dev);
+    uint64_t rx;
+
+    if(!lat)
+        return;
+
+    for(uint32_t i = 0 ; i < n ; i++) {
+        rx = f[i]->owner->ts;
+
+        if(f[i]->ts && now >= f[i]->ts)
+            hist_record(&lat->stage[XCAN_LATENCY_TX], now - f[i]->ts);
+
+        if(!rx || now < rx)
+            continue;
+
+        hist_record(&lat->stage[XCAN_LATENCY_TOTAL], now - rx);
+        if(f[i]->route < XCAN_LATENCY_ROUTES)
+            hist_record(&lat->route[f[i]->route], now - rx);
+    }
+}
+
+#endif /* XCAN_LATENCY */
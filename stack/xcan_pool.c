@@ -0,0 +1,98 @@
+#include "xcan_pool.h"
+
+#define FREE_INDEX(head)    ((uint32_t)(head))
+#define FREE_GEN(head)      ((head) >> 32)
+
+/* Free blocks store the index of the next free block in their first word */
+static inline _Atomic uint32_t* block_link(struct xcan_pool *p, uint32_t index)
+{
+    return (_Atomic uint32_t *)(p->mem + ((size_t)index * p->block_size));
+}
+
+static void* pool_pop(struct xcan_pool *p)
+{
+    uint64_t head = atomic_load_explicit(&p->free_list, memory_order_acquire);
+    uint64_t next;
+
+    while(FREE_INDEX(head)) {
+        next = atomic_load_explicit(block_link(p, FREE_INDEX(head) - 1), memory_order_relaxed);
+        next |= (FREE_GEN(head) + 1) << 32;
+
+        if(atomic_compare_exchange_weak_explicit(&p->free_list, &head, next,
+                                                 memory_order_acquire,
+                                                 memory_order_acquire))
+            return p->mem + ((size_t)(FREE_INDEX(head) - 1) * p->block_size);
+    }
+
+    return NULL;
+}
+
+static void* pool_carve(struct xcan_pool *p)
+{
+    uint32_t carved = atomic_load_explicit(&p->carved, memory_order_relaxed);
+
+    while(carved < p->blocks) {
+        if(atomic_compare_exchange_weak_explicit(&p->carved, &carved, carved + 1,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+            return p->mem + ((size_t)carved * p->block_size);
+    }
+
+    return NULL;
+}
+
+void* xcan_pool_get(struct xcan_pool *p)
+{
+    void *block = pool_pop(p);
+    uint64_t allocs;
+    uint32_t in_use;
+
+    if(!block)
+        block = pool_carve(p);
+
+    if(!block) {
+        /* Pool exhausted */
+        atomic_fetch_add_explicit(&p->exhausted, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    allocs = atomic_fetch_add_explicit(&p->allocs, 1, memory_order_relaxed) + 1;
+
+    /* Peak is tracked on a best effort basis when used across threads */
+    in_use = allocs - atomic_load_explicit(&p->frees, memory_order_relaxed);
+    if(in_use > atomic_load_explicit(&p->peak, memory_order_relaxed))
+        atomic_store_explicit(&p->peak, in_use, memory_order_relaxed);
+
+    return block;
+}
+
+void xcan_pool_put(struct xcan_pool *p, void *block)
+{
+    uint32_t index;
+    uint64_t head, next;
+
+    if(!block)
+        return;
+
+    index = ((uint8_t *)block - p->mem) / p->block_size;
+    head = atomic_load_explicit(&p->free_list, memory_order_relaxed);
+
+    do {
+        atomic_store_explicit(block_link(p, index), FREE_INDEX(head), memory_order_relaxed);
+        next = ((FREE_GEN(head) + 1) << 32) | (index + 1);
+    } while(!atomic_compare_exchange_weak_explicit(&p->free_list, &head, next,
+                                                   memory_order_release,
+                                                   memory_order_relaxed));
+
+    atomic_fetch_add_explicit(&p->frees, 1, memory_order_relaxed);
+}
+
+void xcan_pool_stats(struct xcan_pool *p, struct xcan_pool_stats *stats)
+{
+    stats->blocks = p->blocks;
+    stats->frees = atomic_load_explicit(&p->frees, memory_order_relaxed);
+    stats->allocs = atomic_load_explicit(&p->allocs, memory_order_relaxed);
+    stats->exhausted = atomic_load_explicit(&p->exhausted, memory_order_relaxed);
+    stats->peak = atomic_load_explicit(&p->peak, memory_order_relaxed);
+    stats->in_use = stats->allocs - stats->frees;
+}
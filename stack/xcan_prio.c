@@ -0,0 +1,11 @@
+#include "xcan_prio.h"
+
+struct xcan_prio* xcan_prio_create(void)
+{
+    return XCAN_ZALLOC(sizeof(struct xcan_prio));
+}
+
+void xcan_prio_destroy(struct xcan_prio *p)
+{
+    XCAN_FREE(p);
+}
@@ -0,0 +1,212 @@
+#include "xcan_queue.h"
+
+/* Open addressing with linear probing, at most half full since a queue
+   holds no more marked frames than max_frames */
+struct xcan_queue_index {
+    uint32_t mask;
+    struct {
+        uint32_t id;
+        struct xcan_frame *f;   /* NULL when unused */
+    } slot[];
+};
+
+static inline uint32_t index_hash(uint32_t id)
+{
+    /* Fibonacci hashing */
+    return (id * 2654435769U) >> 7;
+}
+
+/* Returns the slot holding id, or the empty slot where it belongs */
+static uint32_t index_slot(struct xcan_queue_index *x, uint32_t id)
+{
+    uint32_t i = index_hash(id) & x->mask;
+
+    while(x->slot[i].f && x->slot[i].id != id)
+        i = (i + 1) & x->mask;
+
+    return i;
+}
+
+static struct xcan_queue_index* index_create(uint32_t max_frames)
+{
+    struct xcan_queue_index *x;
+    uint32_t slots = 1;
+
+    while(slots < 2 * max_frames)
+        slots <<= 1;
+
+    x = XCAN_ZALLOC(sizeof(struct xcan_queue_index) + slots * sizeof(x->slot[0]));
+    if(x)
+        x->mask = slots - 1;
+
+    return x;
+}
+
+
+int xcan_queue_init(struct xcan_queue *q, enum xcan_queue_type type, uint32_t max_frames)
+{
+    memset(q, 0, sizeof(struct xcan_queue));
+
+    switch(type)
+    {
+        case XCAN_QUEUE_LIST:
+            q->max_frames = max_frames;
+            break;
+
+        case XCAN_QUEUE_RING:
+            q->ring = xcan_ring_create(max_frames);
+            if(!q->ring)
+                return -1;
+
+            q->max_frames = xcan_ring_capacity(q->ring);
+            return 0;
+
+        case XCAN_QUEUE_PRIO:
+            q->prio = xcan_prio_create();
+            if(!q->prio)
+                return -1;
+
+            q->max_frames = max_frames;
+            break;
+
+        default:
+            return -1;
+    }
+
+    /* Unbounded queues do not coalesce */
+    if(q->max_frames) {
+        q->index = index_create(q->max_frames);
+        if(!q->index) {
+            xcan_queue_destroy(q);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void xcan_queue_destroy(struct xcan_queue *q)
+{
+    xcan_queue_empty(q);
+
+    if(q->ring) {
+        xcan_ring_destroy(q->ring);
+        q->ring = NULL;
+    }
+
+    if(q->prio) {
+        xcan_prio_destroy(q->prio);
+        q->prio = NULL;
+    }
+
+    XCAN_FREE(q->index);
+    q->index = NULL;
+}
+
+void xcan_queue_stats(struct xcan_queue *q, struct xcan_queue_stats *out)
+{
+    memset(out, 0, sizeof(struct xcan_queue_stats));
+    out->depth = xcan_queue_len(q);
+    out->max_frames = q->max_frames;
+
+#if XCAN_STATS
+    struct xcan_queue_counters *c = &q->count;
+
+    out->high_water = atomic_load_explicit(&c->high_water, memory_order_relaxed);
+    out->enqueued = atomic_load_explicit(&c->enqueued, memory_order_relaxed);
+    out->dequeued = atomic_load_explicit(&c->dequeued, memory_order_relaxed);
+    out->dropped[XCAN_QUEUE_DROP_FULL] = atomic_load_explicit(&c->full, memory_order_relaxed);
+    out->dropped[XCAN_QUEUE_DROP_COALESCED] = atomic_load_explicit(&c->coalesced, memory_order_relaxed);
+    out->dropped[XCAN_QUEUE_DROP_FLUSHED] = atomic_load_explicit(&c->flushed, memory_order_relaxed);
+#endif
+
+    /* A ring's consumer may not have seen it fill up */
+    if(out->dropped[XCAN_QUEUE_DROP_FULL] && q->ring)
+        out->high_water = q->max_frames;
+
+    if(out->depth > out->high_water)
+        out->high_water = out->depth;
+}
+
+void xcan_queue_reset_stats(struct xcan_queue *q)
+{
+    struct xcan_queue_counters *c = &q->count;
+
+    atomic_store_explicit(&c->enqueued, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->full, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->coalesced, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->dequeued, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->flushed, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->high_water, xcan_queue_len(q), memory_order_relaxed);
+}
+
+uint32_t xcan_queue_suggest_frames(const struct xcan_queue_stats *s)
+{
+    uint32_t need = (s->dropped[XCAN_QUEUE_DROP_FULL] && s->max_frames) ? s->max_frames : s->high_water;
+    uint32_t frames = 1;
+
+    need = (need > XCAN_BURST / 2) ? 2 * need : XCAN_BURST;
+
+    while(frames < need)
+        frames <<= 1;
+
+    return frames;
+}
+
+int xcan_queue_set_coalesce(struct xcan_queue *q, bool coalesce)
+{
+    if(coalesce && !q->index)
+        return -1;
+
+    q->coalesce = coalesce;
+    return 0;
+}
+
+int xcan_queue_coalesce(struct xcan_queue *q, struct xcan_frame *f)
+{
+    struct xcan_queue_index *x = q->index;
+    uint32_t i = index_slot(x, f->id);
+
+    if(!x->slot[i].f)
+        return -1;
+
+    return xcan_frame_replace(x->slot[i].f, f);
+}
+
+void xcan_queue_index_add(struct xcan_queue *q, struct xcan_frame *f)
+{
+    struct xcan_queue_index *x = q->index;
+    uint32_t i = index_slot(x, f->id);
+
+    /* A queued frame that could not be replaced is superseded */
+    x->slot[i].id = f->id;
+    x->slot[i].f = f;
+}
+
+void xcan_queue_index_del(struct xcan_queue *q, struct xcan_frame *f)
+{
+    struct xcan_queue_index *x = q->index;
+    uint32_t i = index_slot(x, f->id), j = i, home;
+
+    if(x->slot[i].f != f)
+        return;
+
+    /* Shift later entries of the probe sequence back into the gap */
+    for(;;) {
+        x->slot[i].f = NULL;
+
+        for(;;) {
+            j = (j + 1) & x->mask;
+            if(!x->slot[j].f)
+                return;
+
+            /* Entry at j may move to i unless its home lies in (i, j] */
+            home = index_hash(x->slot[j].id) & x->mask;
+            if(((j - home) & x->mask) >= ((j - i) & x->mask))
+                break;
+        }
+
+        x->slot[i] = x->slot[j];
+        i = j;
+    }
+}
@@ -0,0 +1,140 @@
+#include "xcan_rcu.h"
+
+struct rcu_reader {
+    _Atomic bool used;
+    _Atomic uint64_t epoch;     /* Last epoch seen quiescent, 0 when offline */
+} XCAN_CACHE_ALIGNED;
+
+struct rcu_retired {
+    struct rcu_retired *next;
+    void *ptr;
+    void (*free_fn)(void *ptr);
+    uint64_t epoch;             /* Readers must have seen this epoch */
+};
+
+static _Atomic uint64_t m_epoch = 1;
+static struct rcu_reader m_readers[XCAN_RCU_MAX_READERS];
+
+static atomic_flag m_retired_lock = ATOMIC_FLAG_INIT;
+static struct rcu_retired *m_retired;
+static _Atomic int m_pending;               /* Objects on m_retired */
+
+static _Thread_local struct rcu_reader *m_self;
+static _Thread_local bool m_online;
+
+
+static struct rcu_reader* reader_claim(void)
+{
+    bool used;
+
+    for(int i = 0 ; i < XCAN_RCU_MAX_READERS ; i++) {
+        used = false;
+        if(atomic_compare_exchange_strong(&m_readers[i].used, &used, true))
+            return &m_readers[i];
+    }
+
+    return NULL;
+}
+
+void xcan_rcu_online(void)
+{
+    if(m_online)
+        return;
+
+    if(!m_self) {
+        m_self = reader_claim();
+        if(!m_self) {
+            dbg("XCAN RCU: Out of reader slots\n");
+            return;
+        }
+    }
+
+    /* Must be visible before any protected pointer is loaded */
+    atomic_store(&m_self->epoch, atomic_load(&m_epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+    m_online = true;
+}
+
+void xcan_rcu_offline(void)
+{
+    if(!m_online)
+        return;
+
+    atomic_store_explicit(&m_self->epoch, 0, memory_order_release);
+    m_online = false;
+}
+
+void xcan_rcu_quiescent(void)
+{
+    if(!m_online)
+        return;
+
+    atomic_store_explicit(&m_self->epoch,
+                          atomic_load_explicit(&m_epoch, memory_order_acquire),
+                          memory_order_release);
+}
+
+int xcan_rcu_retire(void *ptr, void (*free_fn)(void *ptr))
+{
+    struct rcu_retired *r = XCAN_ZALLOC(sizeof(struct rcu_retired));
+
+    if(!r)
+        return -1;
+
+    r->ptr = ptr;
+    r->free_fn = free_fn;
+
+    /* The caller has already unpublished ptr. Readers seeing the new epoch
+       in a quiescent state can no longer hold it. */
+    r->epoch = atomic_fetch_add(&m_epoch, 1) + 1;
+
+    while(atomic_flag_test_and_set_explicit(&m_retired_lock, memory_order_acquire));
+    r->next = m_retired;
+    m_retired = r;
+    atomic_fetch_add_explicit(&m_pending, 1, memory_order_relaxed);
+    atomic_flag_clear_explicit(&m_retired_lock, memory_order_release);
+    return 0;
+}
+
+int xcan_rcu_reclaim(void)
+{
+    struct rcu_retired **link, *r, *done = NULL;
+    uint64_t oldest = UINT64_MAX, epoch;
+    int pending = 0;
+
+    /* Cheap enough to call from the forwarding loop */
+    if(!atomic_load_explicit(&m_pending, memory_order_relaxed))
+        return 0;
+
+    /* Oldest epoch any online reader may still be in */
+    for(int i = 0 ; i < XCAN_RCU_MAX_READERS ; i++) {
+        epoch = atomic_load(&m_readers[i].epoch);
+        if(epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    while(atomic_flag_test_and_set_explicit(&m_retired_lock, memory_order_acquire));
+    link = &m_retired;
+    while((r = *link) != NULL) {
+        if(r->epoch <= oldest) {
+            *link = r->next;
+            r->next = done;
+            done = r;
+        } else {
+            link = &r->next;
+            pending++;
+        }
+    }
+    atomic_store_explicit(&m_pending, pending, memory_order_relaxed);
+    atomic_flag_clear_explicit(&m_retired_lock, memory_order_release);
+
+    /* Free outside the lock */
+    while(done) {
+        r = done;
+        done = r->next;
+        r->free_fn(r->ptr);
+        XCAN_FREE(r);
+    }
+
+    return pending;
+}
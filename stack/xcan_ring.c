@@ -0,0 +1,31 @@
+#include "xcan_ring.h"
+
+struct xcan_ring* xcan_ring_create(uint32_t capacity)
+{
+    struct xcan_ring *r;
+    size_t size;
+    uint32_t slots = 1;
+
+    if(capacity == 0 || capacity > (1U << 31))
+        return NULL;
+
+    /* Round capacity up to a power of two */
+    while(slots < capacity)
+        slots <<= 1;
+
+    size = sizeof(struct xcan_ring) + slots * sizeof(struct xcan_frame *);
+    size = (size + XCAN_CACHE_LINE - 1) & ~(XCAN_CACHE_LINE - 1);
+
+    r = aligned_alloc(XCAN_CACHE_LINE, size);
+    if(!r)
+        return NULL;
+
+    memset(r, 0, size);
+    r->mask = slots - 1;
+    return r;
+}
+
+void xcan_ring_destroy(struct xcan_ring *r)
+{
+    XCAN_FREE(r);
+}
@@ -1,58 +1,754 @@
 #include "xcan_router.h"
 #include "xcan_device.h"
 #include "xcan_queue.h"
+#include "xcan_rcu.h"
+#include "xcan_time.h"
+#include "xcan_latency.h"
+#include "xcan_trace.h"
+#include "xcan_stats.h"
 
-static struct xcan_routing_table *m_tbl;
+/* Routing entry normalised for compilation. Exact IDs are masks covering
+   every ID bit. */
+struct route_rule {
+    uint32_t format;            /* XCAN_EFF_FLAG or 0 */
+    uint32_t id;                /* ID bits under mask, or first ID of a range */
+    uint32_t mask;              /* Match mask of a mask rule */
+    uint32_t last;              /* Last ID of a range rule */
+    bool range;
+    uint32_t coverage;          /* Number of IDs matched */
+    uint32_t entry;             /* Index in the routing table */
+    xcan_devmask_t devices;
+    bool coalesce;
+};
 
+/* Destinations of the rule that wins for an ID, resolved when the table is
+   compiled */
+struct route_fanout {
+    xcan_devmask_t devices;
+    uint32_t coverage;
+    uint32_t entry;
+};
 
-static int route_frame(struct xcan_frame, int loop_score)
+/* Extended ID rules sharing one mask. Open addressing hash table with
+   linear probing keyed on (id & mask) | XCAN_EFF_FLAG; probing only
+   touches the key array, 16 keys to a cache line, and a hit costs one more
+   access into the fan-out array. */
+struct route_hash {
+    uint32_t mask;
+    uint32_t coverage;
+    uint32_t slot_mask;
+    uint32_t *key;              /* 0 when unused */
+    struct route_fanout *fanout;
+};
+
+/* Extended ID range, disjoint from and sorted against the others */
+struct route_range {
+    uint32_t first;
+    uint32_t last;
+    struct route_fanout fanout;
+};
+
+/* Routing table compiled for lookup. Standard IDs index straight into an
+   array of destination masks with every rule already applied. Extended
+   IDs are looked up in one hash table per distinct mask, most specific
+   first so exact IDs are a single probe, and in a sorted array of ranges.
+
+   When rules overlap the one matching the fewest IDs wins, and between
+   equally specific rules the earlier table entry wins. Entries with
+   identical matches add up their destinations. */
+struct route_map {
+    xcan_devmask_t sff[XCAN_SFF_IDS];
+    uint16_t sff_route[XCAN_SFF_IDS];   /* Winning entry, as xcan_frame.route */
+    struct route_hash *eff_hash;
+    uint32_t no_eff_hash;
+    struct route_range *eff_range;
+    uint32_t no_eff_range;
+    struct route_rule *rule;
+    uint32_t no_rules;
+};
+
+/* Published with release semantics and read once per burst; replaced maps
+   are reclaimed through xcan_rcu */
+static struct route_map *_Atomic m_map;
+
+/* Serialises updates with each other and with filter installation */
+static atomic_flag m_update_lock = ATOMIC_FLAG_INIT;
+
+/* Frames routed during a burst, staged per destination device so each
+   output queue is updated once per burst */
+static struct xcan_frame *m_stage[XCAN_MAX_DEVICES][XCAN_BURST];
+static uint32_t m_staged[XCAN_MAX_DEVICES];
+static xcan_devmask_t m_staged_devices;
+
+
+static inline uint32_t eff_hash(uint32_t key)
 {
-    for(int i = 0 ; i < m_tbl->no_entries ; i++)
-    {
-        if(m_tbl->entry[i].can_id == f->id)
-        {
-            for(int i = 0 ; i < m_tbl->entry[i].no_interfaces ; i++)
-            {
-                if(xcan_enqueue(m_tbl->entry[i].interface_id[i]) == 0) {
-                    loop_score--;
-                }
-                xcan_device_send
-            }
+    /* Fibonacci hashing */
+    return (key * 2654435769U) >> 7;
+}
+
+/* Returns the slot holding key, or the empty slot where it belongs */
+static uint32_t hash_slot(struct route_hash *h, uint32_t key)
+{
+    uint32_t i = eff_hash(key) & h->slot_mask;
+
+    while(h->key[i] != key && h->key[i] != 0)
+        i = (i + 1) & h->slot_mask;
+
+    return i;
+}
+
+static inline int fanout_better(struct route_fanout *a, struct route_fanout *b)
+{
+    return !b || a->coverage < b->coverage ||
+           (a->coverage == b->coverage && a->entry < b->entry);
+}
+
+static struct route_fanout* range_find(struct route_map *map, uint32_t id)
+{
+    uint32_t lo = 0, hi = map->no_eff_range, mid;
+
+    /* Find the last range starting at or before id */
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(map->eff_range[mid].first <= id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == 0 || map->eff_range[lo - 1].last < id)
+        return NULL;
+
+    return &map->eff_range[lo - 1].fanout;
+}
+
+static inline uint16_t fanout_route(const struct route_fanout *f)
+{
+    return (f->entry < XCAN_ROUTE_NONE) ? f->entry : XCAN_ROUTE_NONE;
+}
+
+static xcan_devmask_t eff_lookup(struct route_map *map, uint32_t id, uint16_t *route)
+{
+    struct route_fanout *best = NULL, *f;
+    struct route_hash *h;
+    uint32_t key, i;
+
+    for(uint32_t n = 0 ; n < map->no_eff_hash ; n++) {
+        h = &map->eff_hash[n];
+
+        /* Tables are ordered by coverage, later ones cannot beat a hit */
+        if(best && h->coverage > best->coverage)
+            break;
+
+        key = (id & h->mask) | XCAN_EFF_FLAG;
+        i = hash_slot(h, key);
+        if(h->key[i] == key && fanout_better(&h->fanout[i], best))
+            best = &h->fanout[i];
+    }
+
+    if(map->no_eff_range && (!best || best->coverage > 1)) {
+        f = range_find(map, id);
+        if(f && fanout_better(f, best))
+            best = f;
+    }
+
+    if(!best)
+        return 0;
+
+    *route = fanout_route(best);
+    return best->devices;
+}
+
+/* Returns the destinations of can_id and sets *route to the table entry
+   that decided them */
+static inline xcan_devmask_t route_lookup(struct route_map *map, uint32_t can_id, uint16_t *route)
+{
+    *route = XCAN_ROUTE_NONE;
+
+    if(can_id & XCAN_ERR_FLAG)
+        return 0;
+
+    if(can_id & XCAN_EFF_FLAG)
+        return eff_lookup(map, can_id & XCAN_EFF_MASK, route);
+
+    *route = map->sff_route[can_id & XCAN_SFF_MASK];
+    return map->sff[can_id & XCAN_SFF_MASK];
+}
+
+/* ------- Compilation ------- */
+
+static xcan_devmask_t entry_devices(struct xcan_routing_entry *e)
+{
+    xcan_devmask_t devices = 0;
+
+    for(int i = 0 ; i < e->no_interfaces ; i++) {
+        if(e->interface_id[i] < XCAN_MAX_DEVICES)
+            devices |= (xcan_devmask_t)1 << e->interface_id[i];
+    }
+
+    return devices;
+}
+
+static void rule_init(struct route_rule *r, struct xcan_routing_entry *e, uint32_t entry)
+{
+    uint32_t id_mask = (e->can_id & XCAN_EFF_FLAG) ? XCAN_EFF_MASK : XCAN_SFF_MASK;
+    uint32_t first = e->can_id & id_mask;
+    uint32_t last = e->can_id_last & id_mask;
+
+    r->format = e->can_id & XCAN_EFF_FLAG;
+    r->entry = entry;
+    r->devices = entry_devices(e);
+    r->coalesce = e->coalesce;
+
+    if(last > first) {
+        r->range = true;
+        r->id = first;
+        r->mask = 0;
+        r->last = last;
+        r->coverage = last - first + 1;
+    } else {
+        r->range = false;
+        r->mask = e->can_mask ? (e->can_mask & id_mask) : id_mask;
+        r->id = first & r->mask;
+        r->last = 0;
+        r->coverage = 1U << (__builtin_popcount(id_mask) - __builtin_popcount(r->mask));
+    }
+}
+
+static inline int rule_matches(const struct route_rule *r, uint32_t id)
+{
+    if(r->range)
+        return id >= r->id && id <= r->last;
+
+    return (id & r->mask) == r->id;
+}
+
+static inline int rule_same(const struct route_rule *a, const struct route_rule *b)
+{
+    return a->format == b->format && a->range == b->range && a->id == b->id &&
+           a->mask == b->mask && a->last == b->last;
+}
+
+/* Offer rule r for a fan-out currently won by *winner */
+static void fanout_offer(struct route_fanout *f, const struct route_rule **winner,
+                         const struct route_rule *r)
+{
+    struct route_fanout candidate = {
+        .devices = r->devices,
+        .coverage = r->coverage,
+        .entry = r->entry
+    };
+
+    if(*winner && rule_same(*winner, r)) {
+        f->devices |= r->devices;
+    } else if(!*winner || fanout_better(&candidate, f)) {
+        *f = candidate;
+        *winner = r;
+    }
+}
+
+static int compile_sff(struct route_map *map)
+{
+    struct route_fanout *best = XCAN_ZALLOC(XCAN_SFF_IDS * sizeof(struct route_fanout));
+    const struct route_rule **winner = XCAN_ZALLOC(XCAN_SFF_IDS * sizeof(struct route_rule *));
+    struct route_rule *r;
+
+    if(!best || !winner) {
+        XCAN_FREE(best);
+        XCAN_FREE(winner);
+        return -1;
+    }
+
+    for(uint32_t n = 0 ; n < map->no_rules ; n++) {
+        r = &map->rule[n];
+        if(r->format)
+            continue;
+
+        for(uint32_t id = 0 ; id < XCAN_SFF_IDS ; id++) {
+            if(rule_matches(r, id))
+                fanout_offer(&best[id], &winner[id], r);
         }
     }
-    loop_score--;
 
-    return loop_score;
+    for(uint32_t id = 0 ; id < XCAN_SFF_IDS ; id++) {
+        map->sff[id] = best[id].devices;
+        map->sff_route[id] = winner[id] ? fanout_route(&best[id]) : XCAN_ROUTE_NONE;
+    }
+
+    XCAN_FREE(best);
+    XCAN_FREE(winner);
+    return 0;
 }
 
+static int hash_order(const void *a, const void *b)
+{
+    const struct route_hash *ha = a, *hb = b;
 
-int xcan_router_init(struct xcan_routing_table *routing_table)
+    if(ha->coverage != hb->coverage)
+        return (ha->coverage < hb->coverage) ? -1 : 1;
+
+    return (ha->mask > hb->mask) - (ha->mask < hb->mask);
+}
+
+static int compile_eff_hash(struct route_map *map)
 {
-    m_tbl = routing_table;
+    struct route_hash *h;
+    struct route_rule *r;
+    uint32_t n, i, key, rules, slots, slot;
+
+    map->eff_hash = XCAN_ZALLOC((map->no_rules + 1) * sizeof(struct route_hash));
+    if(!map->eff_hash)
+        return -1;
+
+    /* One table per distinct mask */
+    for(n = 0 ; n < map->no_rules ; n++) {
+        r = &map->rule[n];
+        if(!r->format || r->range)
+            continue;
+
+        for(i = 0 ; i < map->no_eff_hash ; i++) {
+            if(map->eff_hash[i].mask == r->mask)
+                break;
+        }
+
+        if(i == map->no_eff_hash) {
+            map->eff_hash[i].mask = r->mask;
+            map->eff_hash[i].coverage = r->coverage;
+            map->no_eff_hash++;
+        }
+    }
+
+    qsort(map->eff_hash, map->no_eff_hash, sizeof(struct route_hash), hash_order);
+
+    for(i = 0 ; i < map->no_eff_hash ; i++) {
+        h = &map->eff_hash[i];
+
+        for(n = 0, rules = 0 ; n < map->no_rules ; n++) {
+            r = &map->rule[n];
+            if(r->format && !r->range && r->mask == h->mask)
+                rules++;
+        }
+
+        /* Keep the load factor at or below one half */
+        for(slots = 1 ; slots < rules * 2 ; slots <<= 1);
+
+        h->slot_mask = slots - 1;
+        h->key = XCAN_ZALLOC(slots * sizeof(uint32_t));
+        h->fanout = XCAN_ZALLOC(slots * sizeof(struct route_fanout));
+        if(!h->key || !h->fanout)
+            return -1;
+
+        /* Rules are visited in table order, so the first of identical
+           rules sets the entry and the others add their destinations */
+        for(n = 0 ; n < map->no_rules ; n++) {
+            r = &map->rule[n];
+            if(!r->format || r->range || r->mask != h->mask)
+                continue;
+
+            key = r->id | XCAN_EFF_FLAG;
+            slot = hash_slot(h, key);
+            if(h->key[slot] == 0) {
+                h->key[slot] = key;
+                h->fanout[slot].coverage = r->coverage;
+                h->fanout[slot].entry = r->entry;
+            }
+            h->fanout[slot].devices |= r->devices;
+        }
+    }
+
+    return 0;
 }
 
+static int bound_order(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
 
-int xcan_router_receive(struct xcan_frame *f)
+    return (ua > ub) - (ua < ub);
+}
+
+static int compile_eff_range(struct route_map *map)
 {
-    dbg("XCAN Router: Received a frame!");
+    const struct route_rule *winner;
+    struct route_fanout best;
+    struct route_range *seg;
+    struct route_rule *r;
+    uint32_t *bound;
+    uint32_t n, b, bounds = 0;
+
+    bound = XCAN_ZALLOC((2 * map->no_rules + 1) * sizeof(uint32_t));
+    map->eff_range = XCAN_ZALLOC((2 * map->no_rules + 1) * sizeof(struct route_range));
+    if(!bound || !map->eff_range) {
+        XCAN_FREE(bound);
+        return -1;
+    }
+
+    /* Split the ID space at every range boundary */
+    for(n = 0 ; n < map->no_rules ; n++) {
+        r = &map->rule[n];
+        if(r->format && r->range) {
+            bound[bounds++] = r->id;
+            bound[bounds++] = r->last + 1;
+        }
+    }
+
+    qsort(bound, bounds, sizeof(uint32_t), bound_order);
+
+    /* Resolve the winning range of every piece, merging neighbours that
+       end up with the same winner */
+    for(b = 0 ; b + 1 < bounds ; b++) {
+        if(bound[b] == bound[b + 1])
+            continue;
+
+        winner = NULL;
+        memset(&best, 0, sizeof(best));
+
+        for(n = 0 ; n < map->no_rules ; n++) {
+            r = &map->rule[n];
+            if(r->format && r->range && r->id <= bound[b] && r->last >= bound[b + 1] - 1)
+                fanout_offer(&best, &winner, r);
+        }
+
+        if(!winner)
+            continue;
+
+        seg = map->no_eff_range ? &map->eff_range[map->no_eff_range - 1] : NULL;
+        if(seg && seg->last + 1 == bound[b] &&
+           seg->fanout.entry == best.entry && seg->fanout.devices == best.devices) {
+            seg->last = bound[b + 1] - 1;
+            continue;
+        }
+
+        seg = &map->eff_range[map->no_eff_range++];
+        seg->first = bound[b];
+        seg->last = bound[b + 1] - 1;
+        seg->fanout = best;
+    }
+
+    XCAN_FREE(bound);
     return 0;
 }
 
+static void route_map_free(void *ptr)
+{
+    struct route_map *map = ptr;
+
+    if(!map)
+        return;
+
+    for(uint32_t i = 0 ; i < map->no_eff_hash ; i++) {
+        XCAN_FREE(map->eff_hash[i].key);
+        XCAN_FREE(map->eff_hash[i].fanout);
+    }
+
+    XCAN_FREE(map->eff_hash);
+    XCAN_FREE(map->eff_range);
+    XCAN_FREE(map->rule);
+    XCAN_FREE(map);
+}
+
+static struct route_map* route_map_compile(struct xcan_routing_table *tbl)
+{
+    struct route_map *map = XCAN_ZALLOC(sizeof(struct route_map));
+
+    if(!map)
+        return NULL;
+
+    map->rule = XCAN_ZALLOC((tbl->no_entries + 1) * sizeof(struct route_rule));
+    if(!map->rule) {
+        route_map_free(map);
+        return NULL;
+    }
+
+    map->no_rules = tbl->no_entries;
+    for(uint32_t n = 0 ; n < tbl->no_entries ; n++)
+        rule_init(&map->rule[n], &tbl->entry[n], n);
+
+    if(compile_sff(map) != 0 ||
+       compile_eff_hash(map) != 0 ||
+       compile_eff_range(map) != 0) {
+        route_map_free(map);
+        return NULL;
+    }
+
+    return map;
+}
+
+/* ------- Receive Filters ------- */
+
+static int filter_add(struct xcan_filter *f, int n, int max, uint32_t id, uint32_t mask)
+{
+    if(n < max) {
+        f[n].id = id;
+        f[n].mask = mask;
+    }
+
+    return n + 1;
+}
+
+/* Covers first..last with aligned power of two blocks of IDs */
+static int filter_add_range(struct xcan_filter *f, int n, int max, uint32_t format,
+                            uint32_t first, uint32_t last, uint32_t id_mask)
+{
+    uint32_t size;
+
+    while(1) {
+        size = first ? (first & -first) : (id_mask + 1);
+        while(first + size - 1 > last)
+            size >>= 1;
+
+        n = filter_add(f, n, max, format | first, XCAN_EFF_FLAG | (id_mask & ~(size - 1)));
+
+        if(first + size - 1 == last)
+            return n;
 
-int xcan_router_loop(int loop_score)
+        first += size;
+    }
+}
+
+/* Filters accepting every frame that dev_id may have to route elsewhere.
+   Returns the number of filters, or -1 if more than max are needed. */
+static int route_filters(struct route_map *map, uint8_t dev_id,
+                         struct xcan_filter *f, int max)
 {
-    struct xcan_frame *f;
+    xcan_devmask_t others = ~((xcan_devmask_t)1 << dev_id);
+    struct route_rule *r;
+    uint32_t first;
+    int n = 0, sff;
+
+    /* Standard IDs straight from the compiled array, in runs */
+    for(uint32_t id = 0 ; id < XCAN_SFF_IDS ; id++) {
+        if(!(map->sff[id] & others))
+            continue;
 
-    while(loop_score > 0)
+        first = id;
+        while(id + 1 < XCAN_SFF_IDS && (map->sff[id + 1] & others))
+            id++;
+
+        n = filter_add_range(f, n, max, 0, first, id, XCAN_SFF_MASK);
+    }
+
+    /* Too fragmented, let every standard ID through instead */
+    if(n > max / 2)
+        n = filter_add(f, 0, max, 0, XCAN_EFF_FLAG);
+    sff = n;
+
+    for(uint32_t i = 0 ; i < map->no_rules ; i++) {
+        r = &map->rule[i];
+        if(!r->format || !(r->devices & others))
+            continue;
+
+        if(r->range)
+            n = filter_add_range(f, n, max, XCAN_EFF_FLAG, r->id, r->last, XCAN_EFF_MASK);
+        else
+            n = filter_add(f, n, max, XCAN_EFF_FLAG | r->id, XCAN_EFF_FLAG | r->mask);
+    }
+
+    /* Then let every extended ID through */
+    if(n > max)
+        n = filter_add(f, sff, max, XCAN_EFF_FLAG, XCAN_EFF_FLAG);
+
+    return (n > max) ? -1 : n;
+}
+
+static int apply_filters(struct route_map *map, struct xcan_device *dev)
+{
+    struct xcan_filter *f;
+    int n;
+
+    if(!dev->set_filter)
+        return 0;
+
+    f = XCAN_ZALLOC(XCAN_MAX_FILTERS * sizeof(struct xcan_filter));
+    if(!f)
+        return -1;
+
+    n = route_filters(map, dev->id, f, XCAN_MAX_FILTERS);
+    n = dev->set_filter(dev, (n < 0) ? NULL : f, n);
+
+    XCAN_FREE(f);
+    return n;
+}
+
+
+static int filter_device(struct xcan_device *dev, void *map)
+{
+    if(apply_filters(map, dev) == 0)
+        return 0;
+
+    dbg("XCAN Router (%s): Failed to set receive filters\n", dev->name);
+    return -1;
+}
+
+
+static void flush_staged(void)
+{
+    struct xcan_device *dev;
+    uint32_t n;
+    int id;
+
+    while(m_staged_devices)
     {
-        if(dev->q_in->frames == 0)
-            break;
+        id = __builtin_ctzll(m_staged_devices);
+        m_staged_devices &= m_staged_devices - 1;
 
-        f = xcan_dequeue(dev->q_in);
-        if(f) {
-            loop_score = route_frame(f, loop_score);
+        dev = xcan_get_device(id);
+        n = dev ? xcan_enqueue_bulk(dev->q_routed, m_stage[id], m_staged[id]) : 0;
+
+        /* Output queue full */
+        for(uint32_t i = n ; i < m_staged[id] ; i++) {
+            xcan_trace(XCAN_TRACE_TX_DROP, id, m_stage[id][i]->id,
+                       m_stage[id][i]->dev ? m_stage[id][i]->dev->id : XCAN_MAX_DEVICES);
+            xcan_stats_route_inc(m_stage[id][i]->route, queue_full, 1);
+            xcan_frame_discard(m_stage[id][i]);
         }
+
+        if(n < m_staged[id])
+            xcan_stats_inc(id, route, queue_full, m_staged[id] - n);
+
+        m_staged[id] = 0;
     }
+}
+
 
-    return loop_score;
-}
\ No newline at end of file
+static void route_frame(struct route_map *map, struct xcan_frame *f, uint64_t now)
+{
+    uint16_t route;
+    xcan_devmask_t devices = route_lookup(map, f->id, &route);
+    struct xcan_frame *copy;
+    uint8_t opts = 0;
+    int id;
+
+    if(route != XCAN_ROUTE_NONE && map->rule[route].coalesce)
+        opts = XCAN_FRAME_COALESCE;
+
+    xcan_latency_routed(f, now);
+
+    /* Never send a frame back out of the device it came from */
+    if(f->dev) {
+        devices &= ~((xcan_devmask_t)1 << f->dev->id);
+
+        if(devices)
+            xcan_stats_inc(f->dev->id, route, routed, 1);
+        else
+            xcan_stats_inc(f->dev->id, route, unrouted, 1);
+    }
+
+    if(devices)
+        xcan_stats_route_inc(route, frames, 1);
+
+    while(devices)
+    {
+        id = __builtin_ctzll(devices);
+        devices &= devices - 1;
+
+        if(!xcan_get_device(id))
+            continue;
+
+        /* Destinations share the payload of the received frame */
+        copy = xcan_frame_copy(f);
+        if(!copy) {
+            xcan_stats_inc(id, route, no_frame, 1);
+            xcan_stats_route_inc(route, no_frame, 1);
+            continue;
+        }
+
+        xcan_stats_route_inc(route, copies, 1);
+
+        copy->route = route;
+        copy->opts = opts;
+        copy->ts = now;
+
+        if(m_staged[id] == XCAN_BURST)
+            flush_staged();
+
+        m_stage[id][m_staged[id]++] = copy;
+        m_staged_devices |= (xcan_devmask_t)1 << id;
+    }
+}
+
+
+int xcan_router_init(struct xcan_routing_table *routing_table)
+{
+    return xcan_router_update(routing_table);
+}
+
+
+int xcan_router_update(struct xcan_routing_table *routing_table)
+{
+    struct route_map *map, *old;
+
+    if(!routing_table)
+        return -1;
+
+    /* Compile off the forwarding path, then publish in one store */
+    map = route_map_compile(routing_table);
+    if(!map)
+        return -1;
+
+    while(atomic_flag_test_and_set_explicit(&m_update_lock, memory_order_acquire));
+
+    old = atomic_exchange_explicit(&m_map, map, memory_order_acq_rel);
+
+    if(old && xcan_rcu_retire(old, route_map_free) != 0) {
+        /* Cannot tell when the old map is unused, leak it rather than
+           risk freeing it under a reader */
+        dbg("XCAN Router: Failed to retire routing table\n");
+    }
+
+    /* Only take in what the new routes need */
+    xcan_devices_foreach(filter_device, map);
+
+    atomic_flag_clear_explicit(&m_update_lock, memory_order_release);
+
+    xcan_rcu_reclaim();
+    return 0;
+}
+
+
+int xcan_router_filter_device(struct xcan_device *dev)
+{
+    struct route_map *map;
+    int ret = 0;
+
+    /* The current map cannot be retired while the update lock is held */
+    while(atomic_flag_test_and_set_explicit(&m_update_lock, memory_order_acquire));
+
+    map = atomic_load_explicit(&m_map, memory_order_acquire);
+    if(map)
+        ret = apply_filters(map, dev);
+
+    atomic_flag_clear_explicit(&m_update_lock, memory_order_release);
+    return ret;
+}
+
+
+xcan_devmask_t xcan_router_lookup(uint32_t can_id)
+{
+    struct route_map *map = atomic_load_explicit(&m_map, memory_order_acquire);
+    uint16_t route;
+
+    return map ? route_lookup(map, can_id, &route) : 0;
+}
+
+
+int xcan_router_receive(struct xcan_frame *f)
+{
+    return xcan_router_receive_bulk(&f, 1);
+}
+
+
+int xcan_router_receive_bulk(struct xcan_frame **f, int n)
+{
+    struct route_map *map = atomic_load_explicit(&m_map, memory_order_acquire);
+    uint64_t now = xcan_time_ns();
+
+    for(int i = 0 ; i < n ; i++) {
+        if(map)
+            route_frame(map, f[i], now);
+        xcan_frame_discard(f[i]);
+    }
+
+    flush_staged();
+    return 0;
+}
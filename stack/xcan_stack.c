@@ -1,8 +1,10 @@
 #include "xcan_stack.h"
 #include "xcan_router.h"
-
-#define XCAN_LOOP_DIR_IN    0
-#define XCAN_LOOP_DIR_OUT   1
+#include "xcan_rcu.h"
+#include "xcan_event.h"
+#include "xcan_time.h"
+#include "xcan_trace.h"
+#include "xcan_stats.h"
 
 
 /*******************************************************************************
@@ -14,6 +16,11 @@ int xcan_datalink_receive(struct xcan_frame *f)
     return xcan_router_receive(f);
 }
 
+int xcan_datalink_receive_bulk(struct xcan_frame **f, int n)
+{
+    return xcan_router_receive_bulk(f, n);
+}
+
 int xcan_datalink_send(struct xcan_frame *f)
 {
     return 0;
@@ -36,9 +43,16 @@ int xcan_stack_recv(struct xcan_device * dev,
 
     f->dev = dev;
     f->id = can_id;
+    f->flags = flags;
+    f->ts = xcan_time_ns();
     memcpy(f->data, data, len);
-    
+
+    /* Counted first, another thread may take it off q_in straight away */
+    xcan_stats_received(dev, &f, 1);
+
     if(xcan_enqueue(dev->q_in, f) != 0) {
+        xcan_trace(XCAN_TRACE_RX_DROP, dev->id, 1, 1);
+        xcan_stats_inc(dev->id, rx, queue_full, 1);
         xcan_frame_discard(f);
         return 1;
     }
@@ -46,25 +60,262 @@ int xcan_stack_recv(struct xcan_device * dev,
     return 0;
 }
 
+/* Takes a burst of frames allocated by the driver with xcan_frame_alloc().
+   Frames the driver did not timestamp are stamped now. Returns the number
+   of frames accepted; the rest are discarded. */
+int xcan_stack_recv_bulk(struct xcan_device * dev,
+                         struct xcan_frame ** f,
+                         int                  n)
+{
+    uint64_t now = 0;
+    int accepted;
+
+    for(int i = 0 ; i < n ; i++) {
+        f[i]->dev = dev;
+
+        if(!f[i]->ts) {
+            if(!now)
+                now = xcan_time_ns();
+            f[i]->ts = now;
+        }
+    }
+
+    xcan_stats_received(dev, f, n);
+
+    accepted = xcan_enqueue_bulk(dev->q_in, f, n);
+    if(accepted < n) {
+        xcan_trace(XCAN_TRACE_RX_DROP, dev->id, n - accepted, n);
+        xcan_stats_inc(dev->id, rx, queue_full, n - accepted);
+    }
+
+    for(int i = accepted ; i < n ; i++)
+        xcan_frame_discard(f[i]);
+
+    return accepted;
+}
+
 
 /* ------- Initialisation ------- */
 int xcan_stack_init(struct xcan_routing_table *routing_table)
 {
     /* Initialise XCAN Router */
-    if(!xcan_router_init(routing_table))
+    if(xcan_router_init(routing_table) != 0)
         return 1;
 
     return 0;
 }
 
 /* ------- Loop Function -------- */
+
+#define TICK_SHARE_MIN  100     /* Per mille */
+#define TICK_SHARE_MAX  900
+
+static uint64_t m_tick_budget = XCAN_TICK_BUDGET_US * 1000ULL;
+static struct xcan_tick_stats m_tick_stats = { .rx_share = 500 };
+
+/* Moves frames in one direction, a slice at a time, until the clock passes
+   until or no device has any left. Returns true if it stopped with work
+   left. */
+static bool tick_phase(int direction, uint64_t until, uint64_t *now,
+                       uint64_t *elapsed, uint64_t *frames)
+{
+    uint64_t start = *now;
+    bool busy = true;
+    int left;
+
+    while(busy && *now < until) {
+        left = xcan_devices_loop(XCAN_TICK_SLICE, direction);
+        if(left < 0)
+            left = 0;
+        *frames += XCAN_TICK_SLICE - left;
+        *now = xcan_time_ns();
+        busy = (left <= 0);
+    }
+
+    *elapsed += *now - start;
+    return busy;
+}
+
+/* Gives receiving and routing a share of the next tick that follows the
+   backlog each side was left with */
+static void tick_adapt(bool rx_busy, bool tx_busy)
+{
+    struct xcan_device *const *list;
+    uint64_t in = 0, out = 0, target;
+    uint32_t no_devices;
+
+    list = xcan_device_list(&no_devices);
+    for(uint32_t i = 0 ; i < no_devices ; i++) {
+        in += xcan_queue_len(list[i]->q_in);
+        out += xcan_queue_len(list[i]->q_out) + xcan_device_parked(list[i]);
+    }
+
+    /* Work a driver has not read yet only shows as a phase cut short */
+    if(rx_busy)
+        in += XCAN_TICK_SLICE;
+    if(tx_busy)
+        out += XCAN_TICK_SLICE;
+
+    if(in + out == 0)
+        return;
+
+    target = 1000 * in / (in + out);
+    if(target < TICK_SHARE_MIN)
+        target = TICK_SHARE_MIN;
+    if(target > TICK_SHARE_MAX)
+        target = TICK_SHARE_MAX;
+
+    m_tick_stats.rx_share = (3 * m_tick_stats.rx_share + target) / 4;
+}
+
 void xcan_stack_tick(void)
 {
-    int loop_score = 20;
+    struct xcan_tick_stats *st = &m_tick_stats;
+    uint64_t start, now, deadline;
+    bool rx_busy, tx_busy;
+
+    /* Routing data may only be read while online */
+    xcan_rcu_online();
+
+    start = now = xcan_time_ns();
+    deadline = start + m_tick_budget;
+
+    st->budget_ns = m_tick_budget;
+    st->rx_ns = st->tx_ns = 0;
+    st->rx_frames = st->tx_frames = 0;
+
+    /* Receive and route, then send, each in its share of the budget */
+    rx_busy = tick_phase(XCAN_LOOP_DIR_IN, start + m_tick_budget * st->rx_share / 1000,
+                         &now, &st->rx_ns, &st->rx_frames);
+    tx_busy = tick_phase(XCAN_LOOP_DIR_OUT, deadline, &now, &st->tx_ns, &st->tx_frames);
+
+    /* Time one side left over goes to the other, a slice each in turn.
+       Frames routed in the meantime give the sending side work again. */
+    while(now < deadline && (rx_busy || tx_busy)) {
+        if(rx_busy) {
+            rx_busy = tick_phase(XCAN_LOOP_DIR_IN, now + 1, &now, &st->rx_ns, &st->rx_frames);
+            tx_busy = true;
+        }
+        if(tx_busy && now < deadline)
+            tx_busy = tick_phase(XCAN_LOOP_DIR_OUT, now + 1, &now, &st->tx_ns, &st->tx_frames);
+    }
+
+    st->used_ns = now - start;
+    if(now > deadline)
+        st->overruns++;
+    st->ticks++;
+
+    tick_adapt(rx_busy, tx_busy);
+
+    /* No routing data is held between ticks */
+    xcan_rcu_quiescent();
+    xcan_rcu_reclaim();
+}
+
+int xcan_stack_set_tick_budget(uint32_t budget_us)
+{
+    if(budget_us == 0)
+        return -1;
+
+    m_tick_budget = budget_us * 1000ULL;
+    return 0;
+}
+
+void xcan_stack_tick_stats(struct xcan_tick_stats *stats)
+{
+    memcpy(stats, &m_tick_stats, sizeof(struct xcan_tick_stats));
+}
+
+/* ------- Event Loop -------- */
+
+/* Devices whose work cannot be signalled by their file descriptor */
+static bool devices_busy(void)
+{
+    struct xcan_device *const *list, *dev;
+    uint32_t no_devices;
+
+    list = xcan_device_list(&no_devices);
+    for(uint32_t i = 0 ; i < no_devices ; i++) {
+        dev = list[i];
+        if(!dev->events || xcan_queue_len(dev->q_in) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+/* Shortens timeout_ms to wake up for the next retry of a parked frame */
+static int retry_timeout(int timeout_ms)
+{
+    uint64_t deadline = xcan_devices_retry_deadline(), now;
+    int64_t ms;
 
-    /* Receive up to 10 CAN frames into the stack */
-    loop_score = xcan_devices_loop(loop_score, XCAN_LOOP_DIR_IN);
+    if(!deadline)
+        return timeout_ms;
 
-    /* Send up to 10 CAN frames out of the stack */
-    loop_score = xcan_devices_loop(loop_score, XCAN_LOOP_DIR_OUT);
-}
\ No newline at end of file
+    now = xcan_time_ns();
+    ms = (deadline > now) ? (deadline - now + 999999) / 1000000 : 0;
+
+    return (timeout_ms < 0 || ms < timeout_ms) ? ms : timeout_ms;
+}
+
+int xcan_stack_poll(int timeout_ms)
+{
+    struct xcan_device *const *list, *dev;
+    struct xcan_device *serve[XCAN_MAX_DEVICES];
+    uint8_t ready[XCAN_MAX_DEVICES];
+    xcan_devmask_t pending = 0;
+    uint32_t no_devices, k;
+    int n;
+
+    /* The device list is read below, so registered as a reader first */
+    xcan_rcu_online();
+
+    if(devices_busy())
+        timeout_ms = 0;
+    else
+        timeout_ms = retry_timeout(timeout_ms);
+
+    /* Do not hold up reclamation of routing data while asleep */
+    xcan_rcu_offline();
+    n = xcan_event_wait(ready, XCAN_MAX_DEVICES, timeout_ms);
+    xcan_rcu_online();
+
+    if(n < 0)
+        return -1;
+
+    /* Receive and route from devices with input ready, sharing the budget
+       by weight. Devices removed while we slept are no longer found. */
+    for(int i = 0 ; i < n ; i++) {
+        if(xcan_get_device(ready[i]))
+            pending |= (xcan_devmask_t)1 << ready[i];
+    }
+
+    list = xcan_device_list(&no_devices);
+    for(uint32_t i = 0 ; i < no_devices ; i++) {
+        dev = list[i];
+        if(!dev->events || xcan_queue_len(dev->q_in) > 0)
+            pending |= (xcan_devmask_t)1 << dev->id;
+    }
+
+    for(k = 0 ; pending ; pending &= pending - 1)
+        serve[k++] = xcan_get_device(__builtin_ctzll(pending));
+
+    xcan_devices_serve(serve, k, k * XCAN_EVENT_BUDGET, XCAN_LOOP_DIR_IN);
+
+    /* Send what was routed, waking up for output space if it did not fit */
+    for(uint32_t i = k = 0 ; i < no_devices ; i++) {
+        dev = list[i];
+        if(xcan_queue_len(dev->q_out) > 0 || xcan_device_parked(dev) > 0)
+            serve[k++] = dev;
+    }
+
+    xcan_devices_serve(serve, k, k * XCAN_EVENT_BUDGET, XCAN_LOOP_DIR_OUT);
+
+    for(uint32_t i = 0 ; i < k ; i++)
+        xcan_event_want_out(serve[i], xcan_queue_len(serve[i]->q_out) > 0);
+
+    xcan_rcu_quiescent();
+    xcan_rcu_reclaim();
+    return n;
+}
@@ -0,0 +1,163 @@
+#include "xcan_stats.h"
+#include "xcan_time.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static struct xcan_stats_segment m_local;
+
+/* Name of the shared memory object while exported, "" otherwise */
+static char m_shm_name[256];
+
+struct xcan_stats_segment *xcan_stats_seg = &m_local;
+
+static void stats_header_init(struct xcan_stats_segment *seg)
+{
+    seg->hdr = (struct xcan_stats_header) {
+        .magic = XCAN_STATS_MAGIC,
+        .version = XCAN_STATS_VERSION,
+        .size = sizeof(struct xcan_stats_segment),
+        .dev_offset = offsetof(struct xcan_stats_segment, dev),
+        .dev_size = sizeof(struct xcan_stats_dev),
+        .dev_count = XCAN_MAX_DEVICES,
+        .route_offset = offsetof(struct xcan_stats_segment, route),
+        .route_size = sizeof(struct xcan_stats_route),
+        .route_count = XCAN_STATS_ROUTES,
+        .pid = getpid(),
+        .start_ns = xcan_time_ns(),
+    };
+}
+
+int xcan_stats_export(const char *name)
+{
+    struct xcan_stats_segment *seg;
+    int fd;
+
+    if(!name || strlen(name) >= sizeof(m_shm_name) || m_shm_name[0])
+        return -1;
+
+    if(!m_local.hdr.magic)
+        stats_header_init(&m_local);
+
+    /* Replace an object left behind by an earlier run. Readers that still
+       map it keep the old one until they look again. */
+    shm_unlink(name);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        dbg("XCAN Stats: Failed to create %s\n", name);
+        return -1;
+    }
+
+    if(ftruncate(fd, sizeof(struct xcan_stats_segment)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    seg = mmap(NULL, sizeof(struct xcan_stats_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(seg == MAP_FAILED) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    memcpy(seg, &m_local, sizeof(struct xcan_stats_segment));
+    xcan_stats_seg = seg;
+    strcpy(m_shm_name, name);
+    return 0;
+}
+
+void xcan_stats_unexport(void)
+{
+    struct xcan_stats_segment *seg = xcan_stats_seg;
+
+    if(!m_shm_name[0])
+        return;
+
+    memcpy(&m_local, seg, sizeof(struct xcan_stats_segment));
+    xcan_stats_seg = &m_local;
+
+    /* Tell readers still mapping the object that nobody writes it now */
+    seg->hdr.pid = 0;
+    munmap(seg, sizeof(struct xcan_stats_segment));
+
+    shm_unlink(m_shm_name);
+    m_shm_name[0] = '\0';
+}
+
+const struct xcan_stats_segment* xcan_stats_get(void)
+{
+    if(!xcan_stats_seg->hdr.magic)
+        stats_header_init(xcan_stats_seg);
+
+    return xcan_stats_seg;
+}
+
+void xcan_stats_reset(void)
+{
+    struct xcan_stats_segment *seg = xcan_stats_seg;
+
+    for(int i = 0 ; i < XCAN_MAX_DEVICES ; i++) {
+        memset(&seg->dev[i].rx, 0, sizeof(seg->dev[i].rx));
+        memset(&seg->dev[i].route, 0, sizeof(seg->dev[i].route));
+        memset(&seg->dev[i].tx, 0, sizeof(seg->dev[i].tx));
+    }
+
+    memset(seg->route, 0, sizeof(seg->route));
+}
+
+#if XCAN_STATS
+
+void xcan_stats_attach(struct xcan_device *dev)
+{
+    struct xcan_stats_dev *s = xcan_stats_dev(dev->id);
+
+    memset(&s->rx, 0, sizeof(s->rx));
+    memset(&s->route, 0, sizeof(s->route));
+    memset(&s->tx, 0, sizeof(s->tx));
+    memcpy(s->name, dev->name, XCAN_MAX_DEVICE_NAME);
+
+    atomic_store_explicit(&s->present, 1, memory_order_release);
+}
+
+void xcan_stats_detach(struct xcan_device *dev)
+{
+    atomic_store_explicit(&xcan_stats_dev(dev->id)->present, 0, memory_order_release);
+}
+
+static inline void stats_measure(struct xcan_frame **f, uint32_t n, uint64_t *bytes, uint64_t *bits)
+{
+    for(uint32_t i = 0 ; i < n ; i++) {
+        *bytes += f[i]->len;
+        *bits += xcan_frame_bits(f[i]);
+    }
+}
+
+void xcan_stats_received(struct xcan_device *dev, struct xcan_frame **f, uint32_t n)
+{
+    struct xcan_stats_dev *s = xcan_stats_dev(dev->id);
+    uint64_t bytes = 0, bits = 0;
+
+    stats_measure(f, n, &bytes, &bits);
+
+    xcan_stats_add(&s->rx.frames, n);
+    xcan_stats_add(&s->rx.bytes, bytes);
+    xcan_stats_add(&s->rx.bits, bits);
+}
+
+void xcan_stats_sent(struct xcan_device *dev, struct xcan_frame **f, uint32_t n)
+{
+    struct xcan_stats_dev *s = xcan_stats_dev(dev->id);
+    uint64_t bytes = 0, bits = 0;
+
+    stats_measure(f, n, &bytes, &bits);
+
+    xcan_stats_add(&s->tx.frames, n);
+    xcan_stats_add(&s->tx.bytes, bytes);
+    xcan_stats_add(&s->tx.bits, bits);
+}
+
+#endif /* XCAN_STATS */
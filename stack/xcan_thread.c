@@ -0,0 +1,478 @@
+#define _GNU_SOURCE
+
+#include "xcan_thread.h"
+#include "xcan_stack.h"
+#include "xcan_rcu.h"
+#include "xcan_time.h"
+#include "xcan_trace.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/* Wakes a thread only if it went to sleep. The sleeper raises the flag
+   before looking for work a last time, and the waker makes its work
+   visible before reading the flag, so one of them always sees the other. */
+struct thread_waker {
+    _Atomic bool sleeping;
+    int fd;                     /* eventfd */
+} XCAN_CACHE_ALIGNED;
+
+struct thread_dev {
+    struct xcan_device *dev;
+    struct xcan_queue ring;     /* Routing thread to send thread */
+    struct thread_waker rx_wake;        /* Waits for room in q_in */
+    struct thread_waker tx_wake;        /* Waits for routed frames */
+    pthread_t rx;
+    pthread_t tx;
+    bool rx_started;
+    bool tx_started;
+};
+
+static struct thread_dev m_dev[XCAN_MAX_DEVICES];
+static uint32_t m_no_devs;
+
+static struct thread_waker m_route_wake;
+static pthread_t m_route;
+static bool m_route_started;
+
+static _Atomic bool m_stop;
+static int m_stop_fd = -1;      /* Readable once stopping */
+static bool m_running;
+
+
+/* ------- Wakeups ------- */
+
+static int waker_init(struct thread_waker *w)
+{
+    atomic_store(&w->sleeping, false);
+    w->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return (w->fd < 0) ? -1 : 0;
+}
+
+static void waker_close(struct thread_waker *w)
+{
+    if(w->fd >= 0)
+        close(w->fd);
+
+    w->fd = -1;
+}
+
+static inline void waker_wake(struct thread_waker *w)
+{
+    uint64_t one = 1;
+    ssize_t r;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if(atomic_load_explicit(&w->sleeping, memory_order_relaxed)) {
+        r = write(w->fd, &one, sizeof(one));
+        (void) r;
+    }
+}
+
+/* To be followed by a last look for work before thread_wait() */
+static inline void waker_arm(struct thread_waker *w)
+{
+    atomic_store_explicit(&w->sleeping, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void waker_disarm(struct thread_waker *w)
+{
+    uint64_t value;
+    ssize_t r;
+
+    atomic_store_explicit(&w->sleeping, false, memory_order_relaxed);
+    r = read(w->fd, &value, sizeof(value));
+    (void) r;
+}
+
+static inline bool thread_stopping(void)
+{
+    return atomic_load_explicit(&m_stop, memory_order_relaxed);
+}
+
+/* Sleeps until woken through w, fd has events, the pipeline stops or
+   timeout_ms expires. w and fd are optional. */
+static void thread_wait(struct thread_waker *w, int fd, short events, int timeout_ms)
+{
+    struct pollfd p[3] = { { .fd = m_stop_fd, .events = POLLIN } };
+    int n = 1;
+
+    if(w)
+        p[n++] = (struct pollfd) { .fd = w->fd, .events = POLLIN };
+    if(fd >= 0)
+        p[n++] = (struct pollfd) { .fd = fd, .events = events };
+
+    poll(p, n, timeout_ms);
+}
+
+static uint32_t queue_room(struct xcan_queue *q)
+{
+    uint32_t len;
+
+    if(!q->max_frames)
+        return XCAN_EVENT_BUDGET;
+
+    len = xcan_queue_len(q);
+    return (len < q->max_frames) ? q->max_frames - len : 0;
+}
+
+
+/* ------- Receive ------- */
+
+static void* rx_thread(void *arg)
+{
+    struct thread_dev *td = arg;
+    struct xcan_device *dev = td->dev;
+    int fd = dev->get_fd ? dev->get_fd(dev) : -1;
+    int budget, left;
+
+    while(!thread_stopping())
+    {
+        budget = queue_room(dev->q_in);
+        if(budget > XCAN_EVENT_BUDGET)
+            budget = XCAN_EVENT_BUDGET;
+
+        if(budget == 0) {
+            /* The routing thread is behind, leave the frames in the driver */
+            waker_wake(&m_route_wake);
+            waker_arm(&td->rx_wake);
+            if(queue_room(dev->q_in) == 0)
+                thread_wait(&td->rx_wake, -1, 0, -1);
+            waker_disarm(&td->rx_wake);
+            continue;
+        }
+
+        left = dev->poll(dev, budget);
+        if(left < budget) {
+            waker_wake(&m_route_wake);
+            continue;
+        }
+
+        /* Drained */
+        thread_wait(NULL, fd, POLLIN, (fd < 0) ? XCAN_THREAD_IDLE_MS : -1);
+    }
+
+    xcan_trace_detach();
+    return NULL;
+}
+
+
+/* ------- Routing ------- */
+
+static bool route_pending(void)
+{
+    for(uint32_t i = 0 ; i < m_no_devs ; i++) {
+        if(xcan_queue_len(m_dev[i].dev->q_in))
+            return true;
+    }
+
+    return false;
+}
+
+static void* route_thread(void *arg)
+{
+    struct xcan_frame *f[XCAN_BURST];
+    struct thread_dev *td;
+    uint32_t n, routed;
+
+    xcan_rcu_online();
+
+    while(!thread_stopping())
+    {
+        /* A burst from each device in turn */
+        routed = 0;
+        for(uint32_t i = 0 ; i < m_no_devs ; i++) {
+            td = &m_dev[i];
+
+            n = xcan_dequeue_bulk(td->dev->q_in, f, XCAN_BURST);
+            if(n == 0)
+                continue;
+
+            xcan_datalink_receive_bulk(f, n);
+            waker_wake(&td->rx_wake);
+            routed += n;
+        }
+
+        for(uint32_t i = 0 ; i < m_no_devs ; i++) {
+            if(xcan_queue_len(&m_dev[i].ring))
+                waker_wake(&m_dev[i].tx_wake);
+        }
+
+        xcan_rcu_quiescent();
+        xcan_rcu_reclaim();
+
+        if(routed)
+            continue;
+
+        xcan_rcu_offline();
+        waker_arm(&m_route_wake);
+        if(!route_pending())
+            thread_wait(&m_route_wake, -1, 0, -1);
+        waker_disarm(&m_route_wake);
+        xcan_rcu_online();
+    }
+
+    xcan_rcu_offline();
+    xcan_trace_detach();
+    return NULL;
+}
+
+
+/* ------- Send ------- */
+
+/* Moves routed frames into q_out as far as it has room */
+static uint32_t tx_fill(struct thread_dev *td)
+{
+    struct xcan_frame *f[XCAN_BURST];
+    uint32_t n, queued, moved = 0;
+    uint32_t room = queue_room(td->dev->q_out);
+
+    while(room > 0)
+    {
+        n = xcan_dequeue_bulk(&td->ring, f, (room < XCAN_BURST) ? room : XCAN_BURST);
+        if(n == 0)
+            break;
+
+        queued = xcan_enqueue_bulk(td->dev->q_out, f, n);
+        for(uint32_t i = queued ; i < n ; i++)
+            xcan_frame_discard(f[i]);
+
+        moved += n;
+        room = (room > n) ? room - n : 0;
+    }
+
+    return moved;
+}
+
+static int tx_timeout(struct xcan_device *dev)
+{
+    uint64_t deadline = xcan_device_retry_deadline(dev);
+    uint64_t now;
+
+    if(!deadline)
+        return -1;
+
+    now = xcan_time_ns();
+    return (deadline > now) ? (int)((deadline - now + 999999) / 1000000) : 0;
+}
+
+static void* tx_thread(void *arg)
+{
+    struct thread_dev *td = arg;
+    struct xcan_device *dev = td->dev;
+    int fd = dev->get_fd ? dev->get_fd(dev) : -1;
+    int timeout, wait_fd;
+    uint32_t moved, sent;
+
+    while(!thread_stopping())
+    {
+        moved = tx_fill(td);
+        sent = XCAN_EVENT_BUDGET - xcan_device_loop(dev, XCAN_EVENT_BUDGET, XCAN_LOOP_DIR_OUT);
+
+        if(moved || sent)
+            continue;
+
+        /* Wait for routed frames, for the bus to take more while q_out is
+           backed up, or for the next retry */
+        timeout = tx_timeout(dev);
+        wait_fd = -1;
+
+        if(xcan_queue_len(dev->q_out) && !xcan_device_parked(dev)) {
+            if(fd >= 0)
+                wait_fd = fd;
+            else
+                timeout = XCAN_THREAD_IDLE_MS;
+        }
+
+        waker_arm(&td->tx_wake);
+        if(!xcan_queue_len(&td->ring) || !queue_room(dev->q_out))
+            thread_wait(&td->tx_wake, wait_fd, POLLOUT, timeout);
+        waker_disarm(&td->tx_wake);
+    }
+
+    xcan_trace_detach();
+    return NULL;
+}
+
+
+/* ------- Control ------- */
+
+static int thread_spawn(pthread_t *t, void *(*fn)(void *), void *arg, int cpu)
+{
+    pthread_attr_t attr;
+    cpu_set_t set;
+    int r;
+
+    if(pthread_attr_init(&attr) != 0)
+        return -1;
+
+    if(cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(pthread_attr_setaffinity_np(&attr, sizeof(set), &set) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+    }
+
+    r = pthread_create(t, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+
+    return (r == 0) ? 0 : -1;
+}
+
+static int thread_dev_init(struct thread_dev *td, struct xcan_device *dev, uint32_t frames)
+{
+    memset(td, 0, sizeof(struct thread_dev));
+    td->dev = dev;
+    td->rx_wake.fd = td->tx_wake.fd = -1;
+
+    if(waker_init(&td->rx_wake) != 0 || waker_init(&td->tx_wake) != 0)
+        return -1;
+
+    if(xcan_queue_init(&td->ring, XCAN_QUEUE_RING, frames) != 0)
+        return -1;
+
+    /* Both have a single producer and a single consumer from now on */
+    if(xcan_device_set_queue(dev, XCAN_LOOP_DIR_IN, XCAN_QUEUE_RING, frames) != 0) {
+        xcan_queue_destroy(&td->ring);
+        return -1;
+    }
+
+    dev->q_routed = &td->ring;
+    return 0;
+}
+
+static void thread_dev_free(struct thread_dev *td)
+{
+    struct xcan_device *dev = td->dev;
+
+    if(dev->q_routed == &td->ring) {
+        while(xcan_queue_len(&td->ring) && tx_fill(td))
+            ;
+        xcan_queue_empty(&td->ring);
+        xcan_queue_destroy(&td->ring);
+        dev->q_routed = dev->q_out;
+    }
+
+    waker_close(&td->rx_wake);
+    waker_close(&td->tx_wake);
+}
+
+void xcan_thread_config_init(struct xcan_thread_config *cfg)
+{
+    cfg->route_cpu = -1;
+
+    for(int i = 0 ; i < XCAN_MAX_DEVICES ; i++)
+        cfg->rx_cpu[i] = cfg->tx_cpu[i] = -1;
+
+    cfg->ring_frames = 0;
+}
+
+int xcan_thread_start(const struct xcan_thread_config *cfg)
+{
+    struct xcan_thread_config defaults;
+    struct xcan_device* const *devs;
+    struct thread_dev *td;
+    uint32_t n, frames;
+
+    if(m_running)
+        return -1;
+
+    if(!cfg) {
+        xcan_thread_config_init(&defaults);
+        cfg = &defaults;
+    }
+
+    frames = cfg->ring_frames ? cfg->ring_frames : XCAN_DEVICE_QUEUE_FRAMES;
+
+    atomic_store(&m_stop, false);
+    m_running = true;
+    m_route_wake.fd = -1;
+
+    m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_stop_fd < 0 || waker_init(&m_route_wake) != 0)
+        goto fail;
+
+    devs = xcan_device_list(&n);
+    for(m_no_devs = 0 ; m_no_devs < n ; m_no_devs++) {
+        if(thread_dev_init(&m_dev[m_no_devs], devs[m_no_devs], frames) != 0) {
+            dbg("XCAN Thread (%s): Failed to set up device\n", devs[m_no_devs]->name);
+            m_no_devs++;
+            goto fail;
+        }
+    }
+
+    if(thread_spawn(&m_route, route_thread, NULL, cfg->route_cpu) != 0)
+        goto fail;
+    m_route_started = true;
+
+    for(uint32_t i = 0 ; i < m_no_devs ; i++) {
+        td = &m_dev[i];
+
+        if(td->dev->poll) {
+            if(thread_spawn(&td->rx, rx_thread, td, cfg->rx_cpu[td->dev->id]) != 0)
+                goto fail;
+            td->rx_started = true;
+        }
+
+        if(thread_spawn(&td->tx, tx_thread, td, cfg->tx_cpu[td->dev->id]) != 0)
+            goto fail;
+        td->tx_started = true;
+    }
+
+    return 0;
+
+fail:
+    dbg("XCAN Thread: Failed to start\n");
+    xcan_thread_stop();
+    return -1;
+}
+
+void xcan_thread_stop(void)
+{
+    uint64_t one = 1;
+    ssize_t r;
+
+    if(!m_running)
+        return;
+
+    atomic_store(&m_stop, true);
+    if(m_stop_fd >= 0) {
+        r = write(m_stop_fd, &one, sizeof(one));
+        (void) r;
+    }
+
+    if(m_route_started)
+        pthread_join(m_route, NULL);
+    m_route_started = false;
+
+    for(uint32_t i = 0 ; i < m_no_devs ; i++) {
+        if(m_dev[i].rx_started)
+            pthread_join(m_dev[i].rx, NULL);
+        if(m_dev[i].tx_started)
+            pthread_join(m_dev[i].tx, NULL);
+
+        thread_dev_free(&m_dev[i]);
+    }
+
+    m_no_devs = 0;
+    waker_close(&m_route_wake);
+
+    if(m_stop_fd >= 0)
+        close(m_stop_fd);
+    m_stop_fd = -1;
+
+    m_running = false;
+}
+
+bool xcan_thread_running(void)
+{
+    return m_running;
+}
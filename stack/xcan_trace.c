@@ -0,0 +1,168 @@
+#include "xcan_trace.h"
+
+#include <stdio.h>
+
+#define TRACE_CHUNK     64      /* Records copied out before they are checked */
+
+static const struct {
+    const char *name;
+    const char *fmt;    /* Formats a then b */
+} m_points[XCAN_TRACE_POINTS] = {
+    [XCAN_TRACE_DEV_RECV]       = { "dev_recv",       "%u of %u frames" },
+    [XCAN_TRACE_DEV_SEND]       = { "dev_send",       "id %08x, %u bytes" },
+    [XCAN_TRACE_DEV_SEND_BULK]  = { "dev_send_bulk",  "%u of %u frames" },
+    [XCAN_TRACE_RX_DROP]        = { "rx_drop",        "%u of %u frames, q_in full" },
+    [XCAN_TRACE_TX_DROP]        = { "tx_drop",        "id %08x from device %u, q_out full" },
+    [XCAN_TRACE_RETRY_PARK]     = { "retry_park",     "id %08x, failed %u" },
+    [XCAN_TRACE_RETRY_DROP]     = { "retry_drop",     "id %08x after %u attempts" },
+};
+
+static _Atomic(struct xcan_trace_ring *) m_rings[XCAN_TRACE_MAX_THREADS];
+
+#if XCAN_TRACE
+
+_Thread_local struct xcan_trace_ring *xcan_trace_self;
+
+static struct xcan_trace_ring* trace_ring_create(uint8_t index)
+{
+    struct xcan_trace_ring *r = aligned_alloc(XCAN_CACHE_LINE, sizeof(struct xcan_trace_ring));
+
+    if(!r)
+        return NULL;
+
+    memset(r, 0, sizeof(struct xcan_trace_ring));
+    r->index = index;
+    atomic_store(&r->used, true);
+    return r;
+}
+
+struct xcan_trace_ring* xcan_trace_attach(void)
+{
+    struct xcan_trace_ring *r, *expected;
+    bool used;
+
+    /* A ring given back by a thread that exited keeps its place, so the
+       reader does not lose what it had not read yet */
+    for(int i = 0 ; i < XCAN_TRACE_MAX_THREADS ; i++) {
+        r = atomic_load_explicit(&m_rings[i], memory_order_acquire);
+        used = false;
+        if(r && atomic_compare_exchange_strong(&r->used, &used, true))
+            return xcan_trace_self = r;
+    }
+
+    for(int i = 0 ; i < XCAN_TRACE_MAX_THREADS ; i++) {
+        if(atomic_load_explicit(&m_rings[i], memory_order_relaxed))
+            continue;
+
+        r = trace_ring_create(i);
+        if(!r)
+            return NULL;
+
+        expected = NULL;
+        if(atomic_compare_exchange_strong(&m_rings[i], &expected, r))
+            return xcan_trace_self = r;
+
+        XCAN_FREE(r);
+    }
+
+    return NULL;
+}
+
+void xcan_trace_detach(void)
+{
+    if(!xcan_trace_self)
+        return;
+
+    atomic_store(&xcan_trace_self->used, false);
+    xcan_trace_self = NULL;
+}
+
+#endif /* XCAN_TRACE */
+
+/* Copies records out a chunk at a time, then checks the writer has not
+   come round and overwritten them while they were copied */
+static int trace_ring_read(struct xcan_trace_ring *r,
+                           void (*fn)(const struct xcan_trace_record *rec, void *arg), void *arg,
+                           uint64_t *lost)
+{
+    struct xcan_trace_record chunk[TRACE_CHUNK];
+    uint64_t head, oldest, start;
+    uint32_t n;
+    int passed = 0;
+
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    while(r->tail < head)
+    {
+        /* Skip what was overwritten before it could be read. The slot of
+           record head may be being written, so the record it held, head -
+           XCAN_TRACE_RING, counts as gone too. */
+        if(head - r->tail >= XCAN_TRACE_RING) {
+            *lost += head - XCAN_TRACE_RING + 1 - r->tail;
+            r->tail = head - XCAN_TRACE_RING + 1;
+        }
+
+        start = r->tail;
+        n = (head - start < TRACE_CHUNK) ? head - start : TRACE_CHUNK;
+        for(uint32_t i = 0 ; i < n ; i++)
+            chunk[i] = r->rec[(start + i) & (XCAN_TRACE_RING - 1)];
+
+        atomic_thread_fence(memory_order_acquire);
+        head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        oldest = (head >= XCAN_TRACE_RING) ? head - XCAN_TRACE_RING + 1 : 0;
+
+        for(uint32_t i = 0 ; i < n ; i++) {
+            if(start + i < oldest) {
+                (*lost)++;
+                continue;
+            }
+
+            fn(&chunk[i], arg);
+            passed++;
+        }
+
+        r->tail = start + n;
+    }
+
+    return passed;
+}
+
+int xcan_trace_read(void (*fn)(const struct xcan_trace_record *rec, void *arg), void *arg,
+                    uint64_t *lost)
+{
+    struct xcan_trace_ring *r;
+    uint64_t dropped = 0;
+    int passed = 0;
+
+    for(int i = 0 ; i < XCAN_TRACE_MAX_THREADS ; i++) {
+        r = atomic_load_explicit(&m_rings[i], memory_order_acquire);
+        if(r)
+            passed += trace_ring_read(r, fn, arg, &dropped);
+    }
+
+    if(lost)
+        *lost = dropped;
+
+    return passed;
+}
+
+int xcan_trace_format(const struct xcan_trace_record *rec, char *buf, size_t len)
+{
+    int n;
+
+    if(rec->point >= XCAN_TRACE_POINTS)
+        return snprintf(buf, len, "%llu.%09llu T%u unknown point %u",
+                        (unsigned long long)(rec->ts / 1000000000ULL),
+                        (unsigned long long)(rec->ts % 1000000000ULL),
+                        rec->thread, rec->point);
+
+    n = snprintf(buf, len, "%llu.%09llu T%u dev %u %-14s ",
+                 (unsigned long long)(rec->ts / 1000000000ULL),
+                 (unsigned long long)(rec->ts % 1000000000ULL),
+                 rec->thread, rec->dev, m_points[rec->point].name);
+
+    if(n < 0 || (size_t)n >= len)
+        return n;
+
+    return n + snprintf(buf + n, len - n, m_points[rec->point].fmt, rec->a, rec->b);
+}
@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xcan_stats.h"
+
+/* Watches the counters a gateway exported with xcan_stats_export(). Maps
+   the segment read only and never writes to it, so the gateway cannot
+   tell it is being watched. */
+
+#define STAT_MAX_ROUTES     1024
+
+struct stat_dev {
+    bool present;
+    char name[XCAN_MAX_DEVICE_NAME];
+    uint64_t rx_frames, rx_bits, rx_full;
+    uint64_t unrouted, tx_full, no_frame;
+    uint64_t tx_frames, tx_bits, tx_failed, tx_dropped;
+};
+
+struct stat_route {
+    uint64_t frames, copies, queue_full, no_frame;
+};
+
+struct stat_sample {
+    uint64_t ns;
+    struct stat_dev dev[XCAN_MAX_DEVICES];
+    struct stat_route route[STAT_MAX_ROUTES];
+};
+
+static const struct xcan_stats_header *m_hdr;
+static struct stat_sample m_sample[2];
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n name] [-i ms] [-c count] [-t] [-r]\n"
+            "  -n name   shared memory object (default %s)\n"
+            "  -i ms     interval between samples (default 1000)\n"
+            "  -c count  samples to show, 0 for no end (default 0)\n"
+            "  -t        show totals since start once and exit\n"
+            "  -r        show routing table entries too\n",
+            prog, XCAN_STATS_SHM);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int stat_map(const char *name)
+{
+    struct xcan_stats_header hdr;
+    struct stat st;
+    void *seg;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(hdr) ||
+       pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        fprintf(stderr, "%s: Not a counter segment\n", name);
+        close(fd);
+        return -1;
+    }
+
+    if(hdr.magic != XCAN_STATS_MAGIC || hdr.size > st.st_size) {
+        fprintf(stderr, "%s: Not a counter segment\n", name);
+        close(fd);
+        return -1;
+    }
+
+    if(hdr.version != XCAN_STATS_VERSION) {
+        fprintf(stderr, "%s: Layout version %u, this tool reads version %u\n",
+                name, hdr.version, XCAN_STATS_VERSION);
+        close(fd);
+        return -1;
+    }
+
+    if(hdr.dev_size < sizeof(struct xcan_stats_dev) ||
+       hdr.dev_offset + (uint64_t)hdr.dev_count * hdr.dev_size > hdr.size ||
+       hdr.route_size < sizeof(struct xcan_stats_route) ||
+       hdr.route_offset + (uint64_t)hdr.route_count * hdr.route_size > hdr.size) {
+        fprintf(stderr, "%s: Counter layout does not match\n", name);
+        close(fd);
+        return -1;
+    }
+
+    seg = mmap(NULL, hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(seg == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    m_hdr = seg;
+    return 0;
+}
+
+#define LOAD(x)     atomic_load_explicit(&(x), memory_order_relaxed)
+
+static void stat_take(struct stat_sample *s)
+{
+    const uint8_t *base = (const uint8_t *)m_hdr;
+    const struct xcan_stats_dev *d;
+    const struct xcan_stats_route *r;
+    uint32_t n;
+
+    s->ns = now_ns();
+
+    n = (m_hdr->dev_count < XCAN_MAX_DEVICES) ? m_hdr->dev_count : XCAN_MAX_DEVICES;
+    for(uint32_t i = 0 ; i < n ; i++) {
+        d = (const struct xcan_stats_dev *)(base + m_hdr->dev_offset + i * m_hdr->dev_size);
+
+        s->dev[i].present = LOAD(d->present);
+        memcpy(s->dev[i].name, d->name, XCAN_MAX_DEVICE_NAME);
+        s->dev[i].name[XCAN_MAX_DEVICE_NAME - 1] = '\0';
+
+        s->dev[i].rx_frames = LOAD(d->rx.frames);
+        s->dev[i].rx_bits = LOAD(d->rx.bits);
+        s->dev[i].rx_full = LOAD(d->rx.queue_full);
+        s->dev[i].unrouted = LOAD(d->route.unrouted);
+        s->dev[i].tx_full = LOAD(d->route.queue_full);
+        s->dev[i].no_frame = LOAD(d->route.no_frame);
+        s->dev[i].tx_frames = LOAD(d->tx.frames);
+        s->dev[i].tx_bits = LOAD(d->tx.bits);
+        s->dev[i].tx_failed = LOAD(d->tx.failed);
+        s->dev[i].tx_dropped = LOAD(d->tx.dropped);
+    }
+
+    n = (m_hdr->route_count < STAT_MAX_ROUTES) ? m_hdr->route_count : STAT_MAX_ROUTES;
+    for(uint32_t i = 0 ; i < n ; i++) {
+        r = (const struct xcan_stats_route *)(base + m_hdr->route_offset + i * m_hdr->route_size);
+
+        s->route[i].frames = LOAD(r->frames);
+        s->route[i].copies = LOAD(r->copies);
+        s->route[i].queue_full = LOAD(r->queue_full);
+        s->route[i].no_frame = LOAD(r->no_frame);
+    }
+}
+
+/* Counters may go back when the gateway resets them or reuses a device ID */
+static inline uint64_t delta(uint64_t now, uint64_t then)
+{
+    return (now >= then) ? now - then : now;
+}
+
+/* Prints the change from prev to cur, or the totals if prev is NULL */
+static void stat_print(const struct stat_sample *cur, const struct stat_sample *prev)
+{
+    static const struct stat_sample zero;
+    const struct stat_dev *c, *p;
+    double secs;
+    uint32_t n;
+
+    if(!prev) {
+        prev = &zero;
+        secs = (cur->ns - m_hdr->start_ns) / 1e9;
+    } else {
+        secs = (cur->ns - prev->ns) / 1e9;
+    }
+
+    if(secs <= 0)
+        secs = 1;
+
+    printf("%-3s %-15s %9s %9s %9s %9s %8s %8s %8s %8s %8s %8s\n",
+           "dev", "name", "rx/s", "rx kbit/s", "tx/s", "tx kbit/s",
+           "rx_full", "unrouted", "tx_full", "no_frame", "tx_fail", "tx_drop");
+
+    n = (m_hdr->dev_count < XCAN_MAX_DEVICES) ? m_hdr->dev_count : XCAN_MAX_DEVICES;
+    for(uint32_t i = 0 ; i < n ; i++) {
+        c = &cur->dev[i];
+        p = &prev->dev[i];
+
+        if(!c->present)
+            continue;
+
+        printf("%-3u %-15s %9.0f %9.1f %9.0f %9.1f %8llu %8llu %8llu %8llu %8llu %8llu\n",
+               i, c->name,
+               delta(c->rx_frames, p->rx_frames) / secs,
+               delta(c->rx_bits, p->rx_bits) / secs / 1000,
+               delta(c->tx_frames, p->tx_frames) / secs,
+               delta(c->tx_bits, p->tx_bits) / secs / 1000,
+               (unsigned long long)delta(c->rx_full, p->rx_full),
+               (unsigned long long)delta(c->unrouted, p->unrouted),
+               (unsigned long long)delta(c->tx_full, p->tx_full),
+               (unsigned long long)delta(c->no_frame, p->no_frame),
+               (unsigned long long)delta(c->tx_failed, p->tx_failed),
+               (unsigned long long)delta(c->tx_dropped, p->tx_dropped));
+    }
+}
+
+static void stat_print_routes(const struct stat_sample *cur, const struct stat_sample *prev)
+{
+    static const struct stat_sample zero;
+    const struct stat_route *c, *p;
+    uint32_t n;
+
+    if(!prev)
+        prev = &zero;
+
+    printf("%-5s %12s %12s %8s %8s\n", "route", "frames", "copies", "tx_full", "no_frame");
+
+    n = (m_hdr->route_count < STAT_MAX_ROUTES) ? m_hdr->route_count : STAT_MAX_ROUTES;
+    for(uint32_t i = 0 ; i < n ; i++) {
+        c = &cur->route[i];
+        p = &prev->route[i];
+
+        if(c->frames == p->frames && c->queue_full == p->queue_full && c->no_frame == p->no_frame)
+            continue;
+
+        printf("%-5u %12llu %12llu %8llu %8llu\n", i,
+               (unsigned long long)delta(c->frames, p->frames),
+               (unsigned long long)delta(c->copies, p->copies),
+               (unsigned long long)delta(c->queue_full, p->queue_full),
+               (unsigned long long)delta(c->no_frame, p->no_frame));
+    }
+}
+
+static bool stat_writer_alive(void)
+{
+    pid_t pid = m_hdr->pid;
+
+    return pid && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = XCAN_STATS_SHM;
+    bool totals = false, routes = false;
+    long interval = 1000, count = 0;
+    struct timespec ts;
+    int opt, cur = 0;
+
+    while((opt = getopt(argc, argv, "n:i:c:trh")) != -1) {
+        switch(opt) {
+        case 'n': name = optarg; break;
+        case 'i': interval = strtol(optarg, NULL, 0); break;
+        case 'c': count = strtol(optarg, NULL, 0); break;
+        case 't': totals = true; break;
+        case 'r': routes = true; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(interval <= 0 || count < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(stat_map(name) != 0)
+        return 1;
+
+    stat_take(&m_sample[cur]);
+
+    if(totals) {
+        stat_print(&m_sample[cur], NULL);
+        if(routes) {
+            printf("\n");
+            stat_print_routes(&m_sample[cur], NULL);
+        }
+        return 0;
+    }
+
+    ts.tv_sec = interval / 1000;
+    ts.tv_nsec = (interval % 1000) * 1000000L;
+
+    for(long i = 0 ; !count || i < count ; i++) {
+        nanosleep(&ts, NULL);
+
+        cur ^= 1;
+        stat_take(&m_sample[cur]);
+
+        if(!stat_writer_alive())
+            printf("Counters are no longer written\n");
+
+        stat_print(&m_sample[cur], &m_sample[cur ^ 1]);
+        if(routes) {
+            printf("\n");
+            stat_print_routes(&m_sample[cur], &m_sample[cur ^ 1]);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    return 0;
+}